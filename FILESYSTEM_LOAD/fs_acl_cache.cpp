@@ -0,0 +1,240 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Path trie cache of ACLs
+ *
+ ***************************************************************************/
+
+#include "fs_acl_cache.h"
+
+#include <boost/thread/locks.hpp>
+
+using namespace boost;
+using N_Security::ACL;
+
+/*****************************************************************************/
+T_acl_cache::T_node::T_node(T_node* parent_node, const std::string& node_name)
+  : parent(parent_node),
+    name(node_name),
+    chain_key(0),
+    done(false),
+    pending(0)
+{
+}
+
+/*****************************************************************************/
+T_acl_cache::T_node::~T_node()
+{
+  for (T_children::iterator it = children.begin(); it != children.end(); ++it)
+    {
+      delete it->second;
+    }
+}
+
+/*****************************************************************************/
+T_acl_cache::T_acl_cache()
+  : _root(NULL, ""),
+    _nb_acls(0)
+{
+}
+
+/*****************************************************************************/
+T_acl_cache::~T_acl_cache()
+{
+}
+
+/*****************************************************************************/
+void T_acl_cache::split(const std::string& path,
+                        std::vector<std::string>& components)
+{
+  size_t begin = 0;
+  while (begin < path.size())
+    {
+      size_t end = path.find('/', begin);
+      if (end == std::string::npos)
+        {
+          end = path.size();
+        }
+      if (end > begin)
+        {
+          components.push_back(path.substr(begin, end - begin));
+        }
+      begin = end + 1;
+    }
+}
+
+/*****************************************************************************/
+const T_acl_cache::T_node*
+T_acl_cache::find_node(const std::vector<std::string>& components) const
+{
+  const T_node* node = &_root;
+  for (size_t i = 0; i < components.size(); ++i)
+    {
+      T_node::T_children::const_iterator it = node->children.find(components[i]);
+      if (it == node->children.end())
+        {
+          return NULL;
+        }
+      node = it->second;
+    }
+  return node;
+}
+
+/*****************************************************************************/
+T_acl_cache::T_node*
+T_acl_cache::get_node(const std::vector<std::string>& components)
+{
+  T_node* node = &_root;
+  for (size_t i = 0; i < components.size(); ++i)
+    {
+      T_node*& child = node->children[components[i]];
+      if (child == NULL)
+        {
+          child = new T_node(node, components[i]);
+        }
+      node = child;
+    }
+  return node;
+}
+
+/*****************************************************************************/
+bool T_acl_cache::find(const std::string& path, ACL& acl) const
+{
+  std::vector<std::string> components;
+  split(path, components);
+
+  shared_lock<shared_mutex> lock(_mutex);
+  const T_node* node = find_node(components);
+  if (node == NULL || not node->acl)
+    {
+      return false;
+    }
+  acl = *node->acl;
+  return true;
+}
+
+/*****************************************************************************/
+void T_acl_cache::add(const std::string& path, const ACL& acl, bool overwrite)
+{
+  std::vector<std::string> components;
+  split(path, components);
+
+  unique_lock<shared_mutex> lock(_mutex);
+  T_node* node = get_node(components);
+  if (not node->acl)
+    {
+      node->acl.reset(new ACL(acl));
+      ++_nb_acls;
+    }
+  else if (overwrite)
+    {
+      *node->acl = acl;
+    }
+}
+
+/*****************************************************************************/
+bool T_acl_cache::find_chain_key(const std::string& path, uint64_t& chain_key) const
+{
+  std::vector<std::string> components;
+  split(path, components);
+
+  shared_lock<shared_mutex> lock(_mutex);
+  const T_node* node = find_node(components);
+  if (node == NULL || node->chain_key == 0)
+    {
+      return false;
+    }
+  chain_key = node->chain_key;
+  return true;
+}
+
+/*****************************************************************************/
+void T_acl_cache::set_chain_key(const std::string& path, uint64_t chain_key)
+{
+  std::vector<std::string> components;
+  split(path, components);
+
+  unique_lock<shared_mutex> lock(_mutex);
+  get_node(components)->chain_key = chain_key;
+}
+
+/*****************************************************************************/
+void T_acl_cache::directory_done(const std::string& path,
+                                 uint32_t nb_subdirectories)
+{
+  std::vector<std::string> components;
+  split(path, components);
+
+  unique_lock<shared_mutex> lock(_mutex);
+  T_node* node = get_node(components);
+  // Subdirectories are crawled after this call: children are files
+  remove_children(*node);
+  node->done = true;
+  node->pending += nb_subdirectories;
+
+  // Walk up the completed directories
+  while (node != &_root && node->done && node->pending == 0)
+    {
+      T_node* parent = node->parent;
+      remove(node);
+      if (parent->done && parent->pending > 0)
+        {
+          --parent->pending;
+        }
+      node = parent;
+    }
+}
+
+/*****************************************************************************/
+void T_acl_cache::remove_children(T_node& node)
+{
+  for (T_node::T_children::iterator it = node.children.begin();
+       it != node.children.end(); ++it)
+    {
+      remove_children(*it->second);
+      if (it->second->acl)
+        {
+          --_nb_acls;
+        }
+      delete it->second;
+    }
+  node.children.clear();
+}
+
+/*****************************************************************************/
+void T_acl_cache::remove(T_node* node)
+{
+  remove_children(*node);
+  if (node->acl)
+    {
+      --_nb_acls;
+    }
+  node->parent->children.erase(node->name);
+  delete node;
+}
+
+/*****************************************************************************/
+size_t T_acl_cache::size() const
+{
+  shared_lock<shared_mutex> lock(_mutex);
+  return _nb_acls;
+}
@@ -0,0 +1,103 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Path trie cache of ACLs
+ *
+ ***************************************************************************/
+#ifndef _FILESYSTEM_ACL_CACHE_H_
+#define _FILESYSTEM_ACL_CACHE_H_
+
+#include <AFS/SECURITY/tools.h>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/shared_mutex.hpp>
+
+#include <map>
+#include <string>
+#include <vector>
+
+/*****************************************************************************/
+//! @brief ACLs of paths, stored in a tree of path components
+//! Each node only keeps its own name: a path and its variant with a trailing
+//! slash are the same entry. Lookups run concurrently, updates are exclusive.
+//! The ACLs of a directory's files are dropped once the directory has been
+//! processed, and the directory itself once all its subdirectories have been
+//! processed: memory follows the directories being crawled.
+class T_acl_cache
+{
+public:
+  T_acl_cache();
+  ~T_acl_cache();
+
+  //! @brief Get the ACL of a path
+  //! @return false if not in cache
+  bool find(const std::string& path, N_Security::ACL& acl) const;
+
+  //! @brief Add the ACL of a path
+  //! @param overwrite replace the ACL already cached, if any
+  void add(const std::string& path, const N_Security::ACL& acl, bool overwrite);
+
+  //! @brief Get the key of the chain of ACLs of a directory and its ancestors
+  //! @return false if not in cache
+  bool find_chain_key(const std::string& path, uint64_t& chain_key) const;
+
+  //! @brief Set the key of the chain of ACLs of a directory
+  void set_chain_key(const std::string& path, uint64_t chain_key);
+
+  //! @brief A directory has been processed
+  //! ACLs of its files are dropped. It is dropped too, with its parent if
+  //! complete, once its subdirectories are done.
+  //! @param nb_subdirectories number of subdirectories that will be processed
+  void directory_done(const std::string& path, uint32_t nb_subdirectories);
+
+  //! @brief Number of cached ACLs
+  size_t size() const;
+
+private:
+  struct T_node
+  {
+    T_node(T_node* parent_node, const std::string& node_name);
+    ~T_node();
+
+    typedef std::map<std::string, T_node*> T_children;
+
+    T_node*                               parent;
+    std::string                           name;
+    T_children                            children;
+    boost::scoped_ptr<N_Security::ACL>    acl;
+    uint64_t                              chain_key; // 0 if unknown
+    bool                                  done;     // directory processed
+    uint32_t                              pending;  // subdirectories not done
+  };
+
+  mutable boost::shared_mutex _mutex;
+  T_node                      _root;
+  size_t                      _nb_acls;
+
+  static void split(const std::string& path, std::vector<std::string>& components);
+  const T_node* find_node(const std::vector<std::string>& components) const;
+  T_node* get_node(const std::vector<std::string>& components);
+  void remove_children(T_node& node);
+  void remove(T_node* node);
+};
+
+#endif // _FILESYSTEM_ACL_CACHE_H_
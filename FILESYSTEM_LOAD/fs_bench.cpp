@@ -0,0 +1,527 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Crawl benchmark on a synthetic filesystem
+ *
+ ***************************************************************************/
+
+#include "fs_synthetic.h"
+#include "fs_local.h"
+#include "fs_crawler.h"
+#include "fs_digest.h"
+#include "fs_listing.h"
+#include "fs_manifest.h"
+#include "fs_readahead.h"
+#include "fs_state.h"
+
+#include <boost/atomic.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <limits>
+#include <map>
+
+using namespace boost;
+
+/*****************************************************************************/
+//! @brief Crawl settings, from key=value arguments
+struct T_bench_config
+{
+  T_bench_config()
+    : nb_workers(4), read_ahead_depth(4), read_ahead_bytes(64 * 1024 * 1024),
+      secured(false), grown_files(false), order(T_crawler::DEPTH_FIRST) {}
+
+  uint32_t          nb_workers;
+  uint32_t          read_ahead_depth;
+  uint64_t          read_ahead_bytes;
+  bool              secured;
+  bool              grown_files; // files read as if they grew after stat
+  T_crawler::Order  order;
+};
+
+/*****************************************************************************/
+//! @brief Summary of a run, equal for two runs loading the same documents
+struct T_bench_result
+{
+  uint64_t nb_documents;
+  uint64_t nb_bytes;
+  uint64_t checksum;
+
+  bool operator==(const T_bench_result& other) const
+  {
+    return nb_documents == other.nb_documents && nb_bytes == other.nb_bytes
+           && checksum == other.checksum;
+  }
+};
+
+/*****************************************************************************/
+//! @brief Stands for the next filter: counts what it would receive
+struct T_bench_sink
+{
+  T_bench_sink() : nb_documents(0), nb_bytes(0), checksum(0) {}
+
+  void send(const std::string& doc_uri, uint64_t size, uint64_t digest)
+  {
+    ++nb_documents;
+    nb_bytes += size;
+    // Independent of the order documents are received
+    checksum ^= xxhash64(doc_uri.data(), doc_uri.size()) + digest;
+  }
+
+  atomic<uint64_t> nb_documents;
+  atomic<uint64_t> nb_bytes;
+  atomic<uint64_t> checksum;
+};
+
+/*****************************************************************************/
+//! @brief Processes directories as the filesystem load filter does:
+//! listing cache, manifest, state index, read-ahead, digest and SAR.
+//! Documents go to a sink: PaF calls and the filter itself are not measured.
+class T_bench_visitor : public T_crawl_visitor
+{
+public:
+  T_bench_visitor(const T_bench_config& config,
+                  T_filesystem_proxy& fs,
+                  T_filesystem_acl& acl,
+                  T_crawl_state_index& state_index,
+                  T_listing_cache& listing_cache,
+                  T_crawl_manifest& manifest,
+                  T_bench_sink& sink)
+    : nb_entries(0), nb_unchanged_files(0), _config(config), _fs(fs),
+      _acl(acl), _state_index(state_index), _listing_cache(listing_cache),
+      _manifest(manifest), _sink(sink) {}
+
+  virtual void visit_directory(const T_url& url,
+                               std::vector<T_url_ptr>& subdirectories);
+
+  atomic<uint64_t> nb_entries;
+  atomic<uint64_t> nb_unchanged_files;
+
+private:
+  const T_bench_config&   _config;
+  T_filesystem_proxy&     _fs;
+  T_filesystem_acl&       _acl;
+  T_crawl_state_index&    _state_index;
+  T_listing_cache&        _listing_cache;
+  T_crawl_manifest&       _manifest;
+  T_bench_sink&           _sink;
+  boost::thread_specific_ptr<T_read_ahead> _read_ahead; // reader of a worker
+
+  void load_file(T_file_read& file);
+  T_read_ahead& get_read_ahead();
+};
+
+/*****************************************************************************/
+T_read_ahead& T_bench_visitor::get_read_ahead()
+{
+  T_read_ahead* read_ahead = _read_ahead.get();
+  if (read_ahead == NULL)
+    {
+      read_ahead = new T_read_ahead(_fs,
+                                    std::max<uint32_t>(_config.read_ahead_depth, 1),
+                                    _config.read_ahead_bytes,
+                                    std::numeric_limits<uint64_t>::max(), true);
+      _read_ahead.reset(read_ahead);
+    }
+  return *read_ahead;
+}
+
+/*****************************************************************************/
+void T_bench_visitor::visit_directory(const T_url& url,
+                                      std::vector<T_url_ptr>& subdirectories)
+{
+  const std::string& dir_path = url.get_local_path();
+  T_file_info info;
+  _fs.read_file_info(url, info);
+  T_directory_entries entries;
+  if (not _listing_cache.get(dir_path, info.mtime, entries))
+    {
+      time_t listing_time = time(NULL);
+      _fs.list_directory(url, entries);
+      _listing_cache.put(dir_path, info.mtime, listing_time, entries);
+    }
+  _manifest.add_listing(dir_path, entries);
+  nb_entries += entries.size();
+
+  std::string entry_path = dir_path;
+  if (entry_path[entry_path.size() - 1] != '/')
+    {
+      entry_path += '/';
+    }
+  const size_t dir_path_length = entry_path.size();
+
+  T_read_ahead& read_ahead = get_read_ahead();
+  std::vector<size_t> file_indices;
+  for (size_t i = 0; i < entries.size(); ++i)
+    {
+      if (entries.info(i).type == T_file_info::REGULAR_FILE)
+        {
+          file_indices.push_back(i);
+        }
+    }
+  _fs.read_entries_info(url, entries, file_indices);
+
+  // Files of a failed directory are released for the next directory
+  try
+    {
+      size_t nb_files = 0;
+      for (size_t i = 0; i < entries.size(); ++i)
+        {
+          entry_path.resize(dir_path_length);
+          entry_path.append(entries.name_data(i), entries.name_length(i));
+          T_url_ptr entry_url = _fs.create_entry_url(url, entry_path);
+          if (entries.info(i).type == T_file_info::DIRECTORY)
+            {
+              subdirectories.push_back(entry_url);
+              continue;
+            }
+          T_file_info file_info = entries.info(i);
+          if (not file_info.has_attributes)
+            {
+              _fs.read_file_info(*entry_url, file_info);
+            }
+          if (_state_index.is_unchanged(entry_url->get_document_uri(), file_info))
+            {
+              ++nb_unchanged_files;
+              continue;
+            }
+          if (_config.grown_files)
+            {
+              // Contents are larger than stat'ed: buffers must grow while read
+              file_info.size /= 2;
+            }
+          read_ahead.add(entry_url, file_info, 0);
+          ++nb_files;
+        }
+      read_ahead.start();
+      for (size_t i = 0; i < nb_files; ++i)
+        {
+          load_file(read_ahead.wait(i));
+        }
+    }
+  catch(...)
+    {
+      read_ahead.clear();
+      throw;
+    }
+  read_ahead.clear();
+
+  if (_config.secured)
+    {
+      _acl.directory_done(dir_path, subdirectories.size());
+    }
+}
+
+/*****************************************************************************/
+void T_bench_visitor::load_file(T_file_read& file)
+{
+  std::string doc_uri = file.url->get_document_uri();
+  if (not file.error.empty())
+    {
+      _state_index.update(doc_uri, file.info, T_crawl_state_index::LOADED_KO);
+      return;
+    }
+  if (_config.grown_files)
+    {
+      file.info.size = file.data.size();
+    }
+  uint64_t digest = xxhash64(file.data.data(), file.data.size());
+  _state_index.set_digest(doc_uri, digest, file.info.mtime);
+  if (_config.secured)
+    {
+      std::string sar_bytes;
+      _state_index.set_sar_key(doc_uri, _acl.get_sar_layer(*file.url, sar_bytes));
+    }
+  _state_index.update(doc_uri, file.info, T_crawl_state_index::LOADED_OK);
+  _sink.send(doc_uri, file.data.size(), digest);
+}
+
+/*****************************************************************************/
+namespace {
+  double now()
+  {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+  }
+
+  long peak_rss_kb()
+  {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+  }
+
+  void usage(const char* program)
+  {
+    std::cerr
+      << "Usage: " << program << " [key=value]...\n"
+      << "  depth=4 subdirectories=8 files=16 min_size=1024 max_size=1048576\n"
+      << "  acls=16 seed=0 threads=4 order=depth_first|breadth_first\n"
+      << "  read_ahead_depth=4 read_ahead_bytes=67108864 secured=0|1\n"
+      << "  grown_files=0|1 (stat sizes halved, as if files grew before read)\n"
+      << "  work_dir=/tmp\n"
+      << "  root=<local directory> io_engine=sync|io_uring|compare\n"
+      << "  io_queue_depth=32\n"
+      << "Crawls the synthetic tree, or the local directory if root is set,\n"
+      << "twice, full then incremental, and reports entries/s, bytes/s and\n"
+      << "peak RSS of each run. With io_engine=compare, the local directory\n"
+      << "is crawled with each engine and their results are checked equal\n"
+      << "(later runs find a warmer page cache)." << std::endl;
+  }
+
+  //! @brief Crawl the whole tree once, with the state of previous runs
+  template <class T_fs, class T_acl>
+  T_bench_result run(const char* name,
+                     const T_bench_config& config,
+                     T_fs& fs,
+                     const std::string& root_path,
+                     const std::string& work_prefix)
+  {
+    T_acl acl(fs);
+    T_crawl_state_index state_index(work_prefix + ".state");
+    T_listing_cache listing_cache(work_prefix + ".listing");
+    T_crawl_manifest manifest;
+    T_bench_sink sink;
+    T_bench_visitor visitor(config, fs, acl, state_index, listing_cache,
+                            manifest, sink);
+
+    double start = now();
+    {
+      T_crawler crawler(visitor, config.nb_workers, config.order);
+      std::vector<T_url_ptr> roots;
+      roots.push_back(fs.create_url(root_path));
+      crawler.run(roots);
+    }
+    manifest.freeze();
+    std::set<std::string> root_paths;
+    root_paths.insert(root_path);
+    listing_cache.save(manifest, root_paths);
+    state_index.commit();
+    double elapsed = std::max(now() - start, 1e-6);
+
+    printf("%-12s %10lu entries %10lu docs %10lu unchanged %8.3f s"
+           " %12.0f entries/s %10.2f MB/s %8ld KB peak RSS\n",
+           name,
+           static_cast<unsigned long>(visitor.nb_entries),
+           static_cast<unsigned long>(sink.nb_documents),
+           static_cast<unsigned long>(visitor.nb_unchanged_files),
+           elapsed,
+           visitor.nb_entries / elapsed,
+           sink.nb_bytes / elapsed / (1024 * 1024),
+           peak_rss_kb());
+
+    T_bench_result result;
+    result.nb_documents = sink.nb_documents;
+    result.nb_bytes = sink.nb_bytes;
+    result.checksum = sink.checksum;
+    return result;
+  }
+
+  void remove_work_files(const std::string& work_prefix)
+  {
+    unlink((work_prefix + ".state").c_str());
+    unlink((work_prefix + ".listing").c_str());
+  }
+
+  //! @brief Crawl a local directory with each engine, full then incremental
+  //! @return false if engines loaded different documents
+  bool run_local(const T_bench_config& config,
+                 const std::string& root,
+                 const std::vector<bool>& engines,
+                 uint32_t queue_depth,
+                 const std::string& work_prefix)
+  {
+    T_bench_result first;
+    for (size_t i = 0; i < engines.size(); ++i)
+      {
+        T_local_config_ptr local_config(new T_local_config);
+        local_config->fs_type = N_Uri::FILE;
+        local_config->remote_host = "bench";
+        local_config->root_path = root;
+        local_config->use_io_uring = engines[i];
+        local_config->io_queue_depth = queue_depth;
+        T_local_filesystem fs(local_config);
+        fs.connect();
+        if (engines[i] && not fs.uses_io_uring())
+          {
+            throw E_system("io_uring engine not available");
+          }
+        printf("Local tree: %s, %s engine, %u workers%s\n", root.c_str(),
+               engines[i] ? "io_uring" : "sync", config.nb_workers,
+               config.secured ? ", secured" : "");
+        T_bench_result result
+          = run<T_local_filesystem, T_local_acl>("full", config, fs, root,
+                                                 work_prefix);
+        run<T_local_filesystem, T_local_acl>("incremental", config, fs, root,
+                                             work_prefix);
+        fs.disconnect();
+        remove_work_files(work_prefix);
+
+        if (i == 0)
+          {
+            first = result;
+          }
+        else if (not (result == first))
+          {
+            printf("Engines loaded different documents\n");
+            return false;
+          }
+      }
+    if (engines.size() > 1)
+      {
+        printf("Engines loaded the same documents\n");
+      }
+    return true;
+  }
+} // namespace
+
+/*****************************************************************************/
+int main(int argc, char *argv[])
+{
+  T_synthetic_config_ptr fs_config(new T_synthetic_config);
+  fs_config->remote_host = "bench";
+  T_bench_config config;
+  std::string root;
+  std::vector<bool> engines(1, false); // use io_uring
+  uint32_t queue_depth = T_local_config().io_queue_depth;
+
+  try
+    {
+      for (int i = 1; i < argc; ++i)
+        {
+          std::string arg(argv[i]);
+          std::string::size_type equal = arg.find('=');
+          if (equal == std::string::npos)
+            {
+              usage(argv[0]);
+              return 1;
+            }
+          std::string key = arg.substr(0, equal);
+          std::string value = arg.substr(equal + 1);
+          if (key == "depth")
+            fs_config->depth = lexical_cast<uint32_t>(value);
+          else if (key == "subdirectories")
+            fs_config->nb_subdirectories = lexical_cast<uint32_t>(value);
+          else if (key == "files")
+            fs_config->nb_files = lexical_cast<uint32_t>(value);
+          else if (key == "min_size")
+            fs_config->min_file_size = lexical_cast<uint64_t>(value);
+          else if (key == "max_size")
+            fs_config->max_file_size = lexical_cast<uint64_t>(value);
+          else if (key == "acls")
+            fs_config->nb_acls = lexical_cast<uint32_t>(value);
+          else if (key == "seed")
+            fs_config->seed = lexical_cast<uint64_t>(value);
+          else if (key == "work_dir")
+            fs_config->work_dir = value;
+          else if (key == "threads")
+            config.nb_workers = std::max<uint32_t>(lexical_cast<uint32_t>(value), 1);
+          else if (key == "read_ahead_depth")
+            config.read_ahead_depth = lexical_cast<uint32_t>(value);
+          else if (key == "read_ahead_bytes")
+            config.read_ahead_bytes = lexical_cast<uint64_t>(value);
+          else if (key == "secured")
+            config.secured = lexical_cast<bool>(value);
+          else if (key == "grown_files")
+            config.grown_files = lexical_cast<bool>(value);
+          else if (key == "order" && (value == "depth_first"
+                                      || value == "breadth_first"))
+            config.order = (value == "depth_first") ? T_crawler::DEPTH_FIRST
+                                                    : T_crawler::BREADTH_FIRST;
+          else if (key == "root" && not value.empty())
+            root = (value.size() > 1 && *value.rbegin() == '/')
+                   ? value.substr(0, value.size() - 1) : value;
+          else if (key == "io_engine" && value == "sync")
+            engines.assign(1, false);
+          else if (key == "io_engine" && value == "io_uring")
+            engines.assign(1, true);
+          else if (key == "io_engine" && value == "compare")
+            {
+              engines.assign(1, false);
+              engines.push_back(true);
+            }
+          else if (key == "io_queue_depth")
+            queue_depth = std::max<uint32_t>(lexical_cast<uint32_t>(value), 1);
+          else
+            {
+              usage(argv[0]);
+              return 1;
+            }
+        }
+    }
+  catch (bad_lexical_cast&)
+    {
+      usage(argv[0]);
+      return 1;
+    }
+  if (root.empty() && (engines.size() > 1 || engines[0]))
+    {
+      // The synthetic filesystem does no I/O
+      usage(argv[0]);
+      return 1;
+    }
+
+  std::string work_prefix = fs_config->work_dir + "/fs_bench."
+                              + lexical_cast<std::string>(getpid());
+  int status = 0;
+  try
+    {
+      if (not root.empty())
+        {
+          status = run_local(config, root, engines, queue_depth, work_prefix)
+                   ? 0 : 1;
+        }
+      else
+        {
+          T_synthetic_filesystem fs(fs_config);
+          fs.connect();
+          printf("Synthetic tree: %lu entries, %u workers%s\n",
+                 static_cast<unsigned long>(fs.nb_entries()), config.nb_workers,
+                 config.secured ? ", secured" : "");
+          run<T_synthetic_filesystem, T_synthetic_acl>(
+            "full", config, fs, T_synthetic_filesystem::root_path, work_prefix);
+          run<T_synthetic_filesystem, T_synthetic_acl>(
+            "incremental", config, fs, T_synthetic_filesystem::root_path,
+            work_prefix);
+          fs.disconnect();
+        }
+    }
+  catch (E_error& e)
+    {
+      std::cerr << "Benchmark failed: " << e.what() << std::endl;
+      status = 1;
+    }
+  remove_work_files(work_prefix);
+  return status;
+}
+
+//
+// End of file
+//
@@ -0,0 +1,332 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Self-checks of the filter building blocks
+ *
+ ***************************************************************************/
+
+#include "fs_digest.h"
+#include "fs_filter.h"
+#include "fs_local.h"
+#include "fs_mount.h"
+#include "fs_url.h"
+
+#include <boost/algorithm/string/case_conv.hpp>
+
+#include <fnmatch.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+  uint32_t nb_failures = 0;
+
+  void expect(bool condition, const std::string& what)
+  {
+    if (not condition)
+      {
+        ++nb_failures;
+        fprintf(stderr, "FAILED: %s\n", what.c_str());
+      }
+  }
+
+  /***************************************************************************/
+  //! @brief Sanity vectors of the reference xxHash implementation (xxhsum)
+  void check_xxhash64()
+  {
+    static const uint64_t prime32 = 2654435761U;
+    static const uint64_t prime64 = 11400714785074694797ULL;
+
+    // Same pseudo-random buffer as xxhsum
+    std::vector<unsigned char> buffer(222);
+    uint64_t generator = prime32;
+    for (size_t i = 0; i < buffer.size(); ++i)
+      {
+        buffer[i] = static_cast<unsigned char>(generator >> 56);
+        generator *= prime64;
+      }
+
+    struct T_vector
+    {
+      size_t    length;
+      uint64_t  seed;
+      uint64_t  digest;
+    };
+    static const T_vector vectors[] = {
+      { 0,   0,       0xEF46DB3751D8E999ULL },
+      { 1,   0,       0xE934A84ADB052768ULL },
+      { 1,   prime32, 0x5014607643A9B4C3ULL },
+      { 14,  0,       0x8282DCC4994E35C8ULL },
+      { 14,  prime32, 0xC3BD6BF63DEB6DF0ULL },
+      { 222, 0,       0xB641AE8CB691C174ULL },
+      { 222, prime32, 0x20CB8AB7AE10C14AULL },
+    };
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); ++i)
+      {
+        char what[64];
+        snprintf(what, sizeof(what), "xxhash64 of %lu bytes, seed %lu",
+                 static_cast<unsigned long>(vectors[i].length),
+                 static_cast<unsigned long>(vectors[i].seed));
+        expect(xxhash64(&buffer[0], vectors[i].length, vectors[i].seed)
+               == vectors[i].digest, what);
+      }
+
+    const std::string text("Nobody inspects the spammish repetition");
+    expect(xxhash64(text.data(), text.size()) == 0xFBCEA83C8A378BF1ULL,
+           "xxhash64 of a text");
+    expect(xxhash64("abc", 3) == 0x44BC2CF5AD770999ULL, "xxhash64 of abc");
+  }
+
+  /***************************************************************************/
+  //! @brief Reproducible pseudo-random strings (xorshift64)
+  class T_random_text
+  {
+  public:
+    T_random_text(uint64_t seed) : _state(seed) {}
+
+    uint32_t next(uint32_t bound)
+    {
+      _state ^= _state << 13;
+      _state ^= _state >> 7;
+      _state ^= _state << 17;
+      return static_cast<uint32_t>(_state % bound);
+    }
+
+    std::string text(const char* alphabet, uint32_t max_length)
+    {
+      std::string result;
+      for (uint32_t length = next(max_length); length > 0; --length)
+        {
+          result += alphabet[next(strlen(alphabet))];
+        }
+      return result;
+    }
+
+  private:
+    uint64_t _state;
+  };
+
+  /***************************************************************************/
+  //! @brief Patterns fnmatch() never matches, or matches literally
+  void check_glob_edge_cases()
+  {
+    struct T_case
+    {
+      const char* pattern;
+      const char* path;
+      bool        matched;
+    };
+    static const T_case cases[] = {
+      { "\\",       "\\",      false },  // trailing escape
+      { "*\\",      "a\\",     false },
+      { "a\\",      "a",       false },
+      { "a\\\\",    "a\\",     true  },  // escaped backslash
+      { "[a-",      "[a-",     false },  // range without end
+      { "*[*-",     "x[*-",    false },
+      { "[a-\\",    "[a-\\",   false },
+      { "[a\\",     "[a\\",    false },  // escape cut by the end
+      { "[a",       "[a",      true  },  // unterminated: literal '['
+      { "[a-b",     "[a-b",    true  },
+      { "[\\]",     "[]",      true  },
+      { "[a-\\]",   "[a-]",    true  },
+      { "[[:alpha:", "[[:alpha:", true },
+      { "[a-]",     "-",       true  },
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+      {
+        std::list<std::string> patterns(1, cases[i].pattern);
+        T_glob_set glob_set;
+        glob_set.compile(patterns);
+        expect(glob_set.match(cases[i].path) == cases[i].matched,
+               std::string("glob '") + cases[i].pattern + "' on '"
+               + cases[i].path + "'");
+      }
+  }
+
+  /***************************************************************************/
+  //! @brief Glob sets match as fnmatch() on random patterns and paths
+  void check_glob_set()
+  {
+    static const uint32_t nb_cases = 200000;
+    static const char* const pattern_alphabet = "ab/*?[]!-\\A";
+    static const char* const path_alphabet = "ab/A.\\[]-";
+
+    T_random_text random(1);
+    uint32_t nb_reported = 0;
+    for (uint32_t i = 0; i < nb_cases && nb_reported < 10; ++i)
+      {
+        bool case_sensitive = (random.next(2) == 0);
+        std::list<std::string> patterns;
+        for (uint32_t n = 1 + random.next(3); n > 0; --n)
+          {
+            patterns.push_back(random.text(pattern_alphabet, 8));
+          }
+        const std::string path = random.text(path_alphabet, 10);
+
+        T_glob_set glob_set(case_sensitive);
+        glob_set.compile(patterns);
+        bool expected = false;
+        const std::string folded_path = case_sensitive ? path : boost::to_lower_copy(path);
+        for (std::list<std::string>::const_iterator it = patterns.begin();
+             it != patterns.end(); ++it)
+          {
+            const std::string pattern = case_sensitive ? *it : boost::to_lower_copy(*it);
+            expected = expected || (fnmatch(pattern.c_str(), folded_path.c_str(), 0) == 0);
+          }
+        std::string what = "glob set of '" + patterns.front() + "'... on '" + path + "'";
+        if (glob_set.match(path) != expected)
+          {
+            expect(false, what + ": match");
+            ++nb_reported;
+          }
+
+        // Paths under a directory match as announced by the prefix checks
+        const std::string prefix = path + "/";
+        bool may_match = glob_set.may_match_under(prefix);
+        bool match_all = glob_set.match_all_under(prefix);
+        for (uint32_t n = 0; n < 5; ++n)
+          {
+            std::string under = prefix + random.text(path_alphabet, 6);
+            under += (under == prefix) ? "x" : "";
+            bool match = glob_set.match(under);
+            if ((match && not may_match) || (not match && match_all))
+              {
+                expect(false, what + ": prefix checks under '" + under + "'");
+                ++nb_reported;
+              }
+          }
+      }
+  }
+
+  /***************************************************************************/
+  //! @brief Document URIs built without parsing are the ones of the parser
+  void check_document_uri()
+  {
+    static const char* const paths[] = {
+      "/data", "/data/dir/file.txt", "/data/Dir/Upper Case.TXT",
+      "/data/a#b", "/data/a?b=c", "/data/100%", "/data/100%25",
+      "/data/caf\xc3\xa9", "/data/tab\there", "/data/[x]{y}",
+      "/data/a;b=c,d&e", "/data/~user/.hidden", "/data/'quoted' \"name\"",
+      "/data/back\\slash", "/data/a+b@c:d!e$f*(g)",
+    };
+
+    T_local_config_ptr local_config(new T_local_config);
+    local_config->remote_host = "host";
+    local_config->root_path = "/data";
+    T_local_filesystem local_fs(local_config);
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); ++i)
+      {
+        const std::string path(paths[i]);
+        expect(local_fs.create_url(path)->get_document_uri()
+               == N_Uri::T_uri("file://host" + path).get_raw_uri(true, false),
+               "local document URI of " + path);
+
+        const std::string smb_url("smb://host/share" + path);
+        expect(T_samba_url(smb_url).get_document_uri()
+               == N_Uri::T_uri(smb_url).get_raw_uri(true, false),
+               "Samba document URI of " + path);
+      }
+  }
+
+  /***************************************************************************/
+  //! @brief Local URLs are only under the root if they match it up to a '/'
+  bool is_under_root(const T_url_ptr& url)
+  {
+    try
+      {
+        url->get_document_uri();
+        return true;
+      }
+    catch(E_user&)
+      {
+        return false;
+      }
+  }
+
+  bool is_under_local_root(const T_local_filesystem& local_fs,
+                           const std::string& uri)
+  {
+    return is_under_root(local_fs.create_url(N_Uri::T_uri(uri)));
+  }
+
+  void check_local_root()
+  {
+    T_local_config_ptr local_config(new T_local_config);
+    local_config->remote_host = "host";
+    local_config->root_path = "/data";
+    T_local_filesystem local_fs(local_config);
+    expect(is_under_local_root(local_fs, "file://host/data"), "local URL of the root");
+    expect(is_under_local_root(local_fs, "file://host/data/x"), "local URL under the root");
+    expect(not is_under_local_root(local_fs, "file://host/data2"),
+           "local URL of a sibling of the root");
+    expect(not is_under_local_root(local_fs, "file://host/data2/x"),
+           "local URL under a sibling of the root");
+    expect(not is_under_local_root(local_fs, "file://host/dat"),
+           "local URL of a prefix of the root");
+  }
+
+  void check_mount_root()
+  {
+    T_mount_config_ptr mount_config(new T_mount_config);
+    mount_config->remote_host = "host";
+    mount_config->remote_path = "/export";
+    mount_config->mount_point = "/mnt/nfs";
+    T_mounted_filesystem mount_fs(mount_config);
+    expect(is_under_root(mount_fs.create_url(N_Uri::T_uri("nfs://host/export/x"))),
+           "NFS URL under the remote path");
+    expect(not is_under_root(mount_fs.create_url(N_Uri::T_uri("nfs://host/export2/x"))),
+           "NFS URL under a sibling of the remote path");
+    expect(not is_under_root(mount_fs.create_url(N_Uri::T_uri("nfs://host/a/export/x"))),
+           "NFS URL containing the remote path");
+    expect(is_under_root(mount_fs.create_url(std::string("/mnt/nfs/x"))),
+           "path under the mount point");
+    expect(not is_under_root(mount_fs.create_url(std::string("/mnt/nfs2/x"))),
+           "path under a sibling of the mount point");
+    expect(not is_under_root(mount_fs.create_url(std::string("/a/mnt/nfs/x"))),
+           "path containing the mount point");
+  }
+} // namespace
+
+/*****************************************************************************/
+int main()
+{
+  check_xxhash64();
+  check_glob_edge_cases();
+  check_glob_set();
+  check_document_uri();
+  check_local_root();
+  check_mount_root();
+
+  if (nb_failures != 0)
+    {
+      printf("%u check(s) failed\n", nb_failures);
+      return 1;
+    }
+  printf("All checks passed\n");
+  return 0;
+}
+
+//
+// End of file
+//
@@ -0,0 +1,226 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Parallel directory crawler
+ *
+ ***************************************************************************/
+
+#include "fs_crawler.h"
+
+#include <COMMON/BASIC/log.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+using namespace boost;
+
+/*****************************************************************************/
+T_crawl_visitor::~T_crawl_visitor()
+{
+}
+
+/*****************************************************************************/
+T_crawler::T_crawler(T_crawl_visitor& visitor,
+                     uint32_t nb_workers,
+                     Order order,
+                     uint32_t max_frontier)
+  : _visitor(visitor),
+    _order(order),
+    _max_frontier(max_frontier),
+    _nb_queued(0),
+    _frontier_capped(false),
+    _nb_pending(0),
+    _generation(0)
+{
+  if (nb_workers == 0)
+    {
+      nb_workers = 1;
+    }
+  for (uint32_t i = 0; i < nb_workers; ++i)
+    {
+      _queues.push_back(new T_work_queue());
+    }
+}
+
+/*****************************************************************************/
+T_crawler::~T_crawler()
+{
+}
+
+/*****************************************************************************/
+void T_crawler::run(const std::vector<T_url_ptr>& roots)
+{
+  LOG(INFO, 6) << "Start crawling " << roots.size() << " director"
+               << ((roots.size() > 1) ? "ies" : "y")
+               << " with " << _queues.size() << " worker(s), "
+               << ((_order == BREADTH_FIRST) ? "breadth" : "depth") << " first";
+  push(0, roots);
+
+  // Caller thread is worker 0, others are started only when needed
+  thread_group workers;
+  for (uint32_t i = 1; i < _queues.size(); ++i)
+    {
+      workers.create_thread(bind(&T_crawler::worker_loop, this, i));
+    }
+  worker_loop(0);
+  workers.join_all();
+
+  LOG(INFO, 6) << "End of crawl";
+}
+
+/*****************************************************************************/
+void T_crawler::worker_loop(uint32_t worker_id)
+{
+  for (;;)
+    {
+      uint64_t generation;
+      {
+        mutex::scoped_lock lock(_state_mutex);
+        generation = _generation;
+      }
+
+      T_url_ptr directory;
+      if (pop(worker_id, directory) || steal(worker_id, directory))
+        {
+          std::vector<T_url_ptr> subdirectories;
+          visit(*directory, subdirectories);
+          push(worker_id, subdirectories);
+          done();
+          continue;
+        }
+
+      // Nothing to do: wait for new directories or for the end of the crawl
+      mutex::scoped_lock lock(_state_mutex);
+      while (_nb_pending > 0 && _generation == generation)
+        {
+          _state_changed.wait(lock);
+        }
+      if (_nb_pending == 0)
+        {
+          return;
+        }
+    }
+}
+
+/*****************************************************************************/
+void T_crawler::visit(const T_url& url, std::vector<T_url_ptr>& subdirectories)
+{
+  try
+    {
+      _visitor.visit_directory(url, subdirectories);
+    }
+  catch(E_error& e)
+    {
+      LOG(ERROR, 1) << "Could not crawl directory: " << url.get_local_path()
+                    << " [" << e.what() << "]";
+      subdirectories.clear();
+    }
+  catch(...)
+    {
+      LOG(ERROR, 1) << "Could not crawl directory: " << url.get_local_path();
+      subdirectories.clear();
+    }
+}
+
+/*****************************************************************************/
+void T_crawler::push(uint32_t worker_id,
+                     const std::vector<T_url_ptr>& directories)
+{
+  if (directories.empty())
+    {
+      return;
+    }
+  {
+    T_work_queue& queue = _queues[worker_id];
+    mutex::scoped_lock lock(queue.mutex);
+    // Reverse order so that pop() returns directories in listing order
+    queue.directories.insert(queue.directories.end(),
+                             directories.rbegin(), directories.rend());
+  }
+  _nb_queued += directories.size();
+  mutex::scoped_lock lock(_state_mutex);
+  _nb_pending += directories.size();
+  ++_generation;
+  _state_changed.notify_all();
+}
+
+/*****************************************************************************/
+bool T_crawler::pop(uint32_t worker_id, T_url_ptr& directory)
+{
+  T_work_queue& queue = _queues[worker_id];
+  mutex::scoped_lock lock(queue.mutex);
+  if (queue.directories.empty())
+    {
+      return false;
+    }
+  bool breadth_first = (_order == BREADTH_FIRST);
+  if (breadth_first && _max_frontier > 0 && _nb_queued > _max_frontier)
+    {
+      breadth_first = false;
+      if (not _frontier_capped.exchange(true))
+        {
+          LOG(INFO, 4) << "Crawl frontier over " << _max_frontier
+                       << " directories: crawling depth first";
+        }
+    }
+  if (breadth_first)
+    {
+      directory = queue.directories.front();
+      queue.directories.pop_front();
+    }
+  else
+    {
+      directory = queue.directories.back();
+      queue.directories.pop_back();
+    }
+  --_nb_queued;
+  return true;
+}
+
+/*****************************************************************************/
+bool T_crawler::steal(uint32_t worker_id, T_url_ptr& directory)
+{
+  for (uint32_t i = 1; i < _queues.size(); ++i)
+    {
+      T_work_queue& victim = _queues[(worker_id + i) % _queues.size()];
+      mutex::scoped_lock lock(victim.mutex);
+      if (not victim.directories.empty())
+        {
+          directory = victim.directories.front();
+          victim.directories.pop_front();
+          --_nb_queued;
+          return true;
+        }
+    }
+  return false;
+}
+
+/*****************************************************************************/
+void T_crawler::done()
+{
+  mutex::scoped_lock lock(_state_mutex);
+  --_nb_pending;
+  if (_nb_pending == 0)
+    {
+      _state_changed.notify_all();
+    }
+}
@@ -0,0 +1,109 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Parallel directory crawler
+ *
+ ***************************************************************************/
+#ifndef _FILESYSTEM_CRAWLER_H_
+#define _FILESYSTEM_CRAWLER_H_
+
+#include "fs_url.h"
+
+#include <boost/atomic.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include <deque>
+#include <vector>
+
+/*****************************************************************************/
+//! @brief Receives the directories reached by the crawler
+class T_crawl_visitor
+{
+public:
+  virtual ~T_crawl_visitor();
+
+  //! @brief Process a directory and its files
+  //! Called concurrently from several crawl workers.
+  //! @param url the directory to process
+  //! @param subdirectories (out) accepted subdirectories to crawl next
+  virtual void visit_directory(const T_url& url,
+                               std::vector<T_url_ptr>& subdirectories) = 0;
+};
+
+/*****************************************************************************/
+//! @brief Walks directory trees with a pool of work-stealing workers
+//! Each worker owns a queue of directories: it takes its own work from the
+//! back (depth first) and steals from the front of the other queues (oldest,
+//! thus largest, subtrees first) when its own queue is empty.
+//! In breadth first order, workers take their own work from the front while
+//! the number of queued directories is under a limit, then fall back to depth
+//! first, which keeps the frontier to the siblings of the current path.
+class T_crawler
+{
+public:
+  enum Order { DEPTH_FIRST, BREADTH_FIRST };
+
+  //! @param visitor called for each directory
+  //! @param nb_workers number of workers, 1 means crawling in caller thread
+  //! @param order order of the directories taken by each worker
+  //! @param max_frontier number of queued directories above which the crawl
+  //! is depth first, 0 for no limit
+  T_crawler(T_crawl_visitor& visitor,
+            uint32_t nb_workers,
+            Order order = DEPTH_FIRST,
+            uint32_t max_frontier = 0);
+  ~T_crawler();
+
+  //! @brief Crawl the given directories and all their subdirectories
+  //! Returns when every reachable directory has been visited.
+  void run(const std::vector<T_url_ptr>& roots);
+
+private:
+  struct T_work_queue
+  {
+    boost::mutex            mutex;
+    std::deque<T_url_ptr>   directories;
+  };
+
+  T_crawl_visitor&                  _visitor;
+  boost::ptr_vector<T_work_queue>   _queues;
+  Order                             _order;
+  uint32_t                          _max_frontier;
+  boost::atomic<uint32_t>           _nb_queued;   // in all the queues
+  boost::atomic<bool>               _frontier_capped;
+
+  boost::mutex                      _state_mutex;
+  boost::condition_variable         _state_changed;
+  uint32_t                          _nb_pending;  // queued or being visited
+  uint64_t                          _generation;  // bumped on each push
+
+  void worker_loop(uint32_t worker_id);
+  void visit(const T_url& url, std::vector<T_url_ptr>& subdirectories);
+  void push(uint32_t worker_id, const std::vector<T_url_ptr>& directories);
+  bool pop(uint32_t worker_id, T_url_ptr& directory);
+  bool steal(uint32_t worker_id, T_url_ptr& directory);
+  void done();
+};
+
+#endif // _FILESYSTEM_CRAWLER_H_
@@ -0,0 +1,135 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Fast digest of file contents
+ *
+ ***************************************************************************/
+
+#include "fs_digest.h"
+
+namespace {
+  static const uint64_t prime1 = 11400714785074694791ULL;
+  static const uint64_t prime2 = 14029467366897019727ULL;
+  static const uint64_t prime3 = 1609587929392839161ULL;
+  static const uint64_t prime4 = 9650029242287828579ULL;
+  static const uint64_t prime5 = 2870177450012600261ULL;
+
+  inline uint64_t rotl(uint64_t x, int r)
+  {
+    return (x << r) | (x >> (64 - r));
+  }
+
+  // Unaligned little-endian reads
+  inline uint64_t read64(const unsigned char* p)
+  {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i)
+      {
+        v = (v << 8) | p[i];
+      }
+    return v;
+  }
+
+  inline uint32_t read32(const unsigned char* p)
+  {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8)
+      | (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+  }
+
+  inline uint64_t xx_round(uint64_t acc, uint64_t input)
+  {
+    acc += input * prime2;
+    acc = rotl(acc, 31);
+    return acc * prime1;
+  }
+
+  inline uint64_t merge_round(uint64_t acc, uint64_t val)
+  {
+    acc ^= xx_round(0, val);
+    return acc * prime1 + prime4;
+  }
+} // namespace
+
+/*****************************************************************************/
+uint64_t xxhash64(const void* data, size_t length, uint64_t seed)
+{
+  const unsigned char* p = static_cast<const unsigned char*>(data);
+  const unsigned char* end = p + length;
+  uint64_t h;
+
+  if (length >= 32)
+    {
+      // Four independent lanes of 8 bytes
+      const unsigned char* limit = end - 32;
+      uint64_t v1 = seed + prime1 + prime2;
+      uint64_t v2 = seed + prime2;
+      uint64_t v3 = seed;
+      uint64_t v4 = seed - prime1;
+      do
+        {
+          v1 = xx_round(v1, read64(p));
+          v2 = xx_round(v2, read64(p + 8));
+          v3 = xx_round(v3, read64(p + 16));
+          v4 = xx_round(v4, read64(p + 24));
+          p += 32;
+        }
+      while (p <= limit);
+
+      h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+      h = merge_round(h, v1);
+      h = merge_round(h, v2);
+      h = merge_round(h, v3);
+      h = merge_round(h, v4);
+    }
+  else
+    {
+      h = seed + prime5;
+    }
+
+  h += static_cast<uint64_t>(length);
+
+  while (p + 8 <= end)
+    {
+      h ^= xx_round(0, read64(p));
+      h = rotl(h, 27) * prime1 + prime4;
+      p += 8;
+    }
+  if (p + 4 <= end)
+    {
+      h ^= static_cast<uint64_t>(read32(p)) * prime1;
+      h = rotl(h, 23) * prime2 + prime3;
+      p += 4;
+    }
+  while (p < end)
+    {
+      h ^= (*p) * prime5;
+      h = rotl(h, 11) * prime1;
+      ++p;
+    }
+
+  h ^= h >> 33;
+  h *= prime2;
+  h ^= h >> 29;
+  h *= prime3;
+  h ^= h >> 32;
+  return h;
+}
@@ -0,0 +1,36 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Fast digest of file contents
+ *
+ ***************************************************************************/
+#ifndef _FILESYSTEM_DIGEST_H_
+#define _FILESYSTEM_DIGEST_H_
+
+#include <stdint.h>
+#include <cstddef>
+
+//! @brief 64-bit xxHash of a buffer
+//! Not cryptographic: only used to detect changes of file contents.
+uint64_t xxhash64(const void* data, size_t length, uint64_t seed = 0);
+
+#endif // _FILESYSTEM_DIGEST_H_
@@ -0,0 +1,447 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Compiled path filters
+ *
+ ***************************************************************************/
+
+#include "fs_filter.h"
+
+#include <COMMON/BASIC/log.h>
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/foreach.hpp>
+
+#include <algorithm>
+#include <cctype>
+
+
+/*****************************************************************************/
+T_glob_set::T_glob_set(bool case_sensitive)
+  : _is_case_sensitive(case_sensitive)
+{
+}
+
+/*****************************************************************************/
+void T_glob_set::compile(const list<string>& patterns)
+{
+  _patterns.clear();
+  _trie.clear();
+  _trie.push_back(T_trie_node());
+
+  BOOST_FOREACH(string source, patterns)
+    {
+      if (not _is_case_sensitive)
+        {
+          boost::to_lower(source);
+        }
+      uint32_t pattern_id = _patterns.size();
+      _patterns.push_back(parse(source));
+      const T_pattern& pattern = _patterns.back();
+
+      // Literal prefix goes into the trie
+      uint32_t node = 0;
+      for (size_t i = 0; i < pattern.prefix_length; ++i)
+        {
+          unsigned char c = pattern.tokens[i].c;
+          map<unsigned char, uint32_t>::const_iterator child
+            = _trie[node].children.find(c);
+          if (child == _trie[node].children.end())
+            {
+              uint32_t new_node = _trie.size();
+              _trie.push_back(T_trie_node());
+              _trie[node].children[c] = new_node;
+              node = new_node;
+            }
+          else
+            {
+              node = child->second;
+            }
+        }
+      _trie[node].patterns.push_back(pattern_id);
+    }
+}
+
+/*****************************************************************************/
+T_glob_set::T_pattern T_glob_set::parse(const string& source)
+{
+  T_pattern pattern;
+  pattern.source = source;
+
+  size_t pos = 0;
+  while (pos < source.size())
+    {
+      T_token token;
+      token.kind = T_token::CHAR;
+      token.c = source[pos];
+
+      switch (source[pos])
+        {
+        case '*':
+          token.kind = T_token::ANY_STRING;
+          ++pos;
+          if (not pattern.tokens.empty()
+              && pattern.tokens.back().kind == T_token::ANY_STRING)
+            {
+              continue; // "**" is "*"
+            }
+          break;
+        case '?':
+          token.kind = T_token::ANY_CHAR;
+          ++pos;
+          break;
+        case '[':
+          {
+            size_t end = parse_class(source, pos, token);
+            // Unterminated class: '[' is a literal
+            pos = (end == string::npos) ? pos + 1 : end;
+          }
+          break;
+        case '\\':
+          if (pos + 1 < source.size())
+            {
+              ++pos;
+              token.c = source[pos];
+            }
+          else
+            {
+              // Trailing escape: fnmatch() never matches the pattern
+              token.kind = T_token::CLASS;
+            }
+          ++pos;
+          break;
+        default:
+          ++pos;
+        }
+      pattern.tokens.push_back(token);
+    }
+
+  pattern.prefix_length = 0;
+  while (pattern.prefix_length < pattern.tokens.size()
+         && pattern.tokens[pattern.prefix_length].kind == T_token::CHAR)
+    {
+      ++pattern.prefix_length;
+    }
+  pattern.star_suffix = pattern.tokens.size();
+  while (pattern.star_suffix > 0
+         && pattern.tokens[pattern.star_suffix - 1].kind == T_token::ANY_STRING)
+    {
+      --pattern.star_suffix;
+    }
+  return pattern;
+}
+
+/*****************************************************************************/
+size_t T_glob_set::match_nothing(const string& source, T_token& token)
+{
+  token.kind = T_token::CLASS;
+  token.chars.reset();
+  return source.size();
+}
+
+/*****************************************************************************/
+size_t T_glob_set::parse_class(const string& source, size_t pos, T_token& token)
+{
+  static const struct { const char* name; int (*is_member)(int); } named_classes[] = {
+    { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+    { "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+    { "lower", islower }, { "print", isprint }, { "punct", ispunct },
+    { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit }
+  };
+
+  size_t i = pos + 1;
+  bool negated = false;
+  if (i < source.size() && (source[i] == '!' || source[i] == '^'))
+    {
+      negated = true;
+      ++i;
+    }
+
+  bitset<256> chars;
+  bool first = true;
+  while (i < source.size())
+    {
+      char c = source[i];
+      if (c == ']' && not first)
+        {
+          token.kind = T_token::CLASS;
+          token.chars = negated ? ~chars : chars;
+          return i + 1;
+        }
+      first = false;
+
+      // Named class, eg [:alpha:]
+      if (c == '[' && i + 1 < source.size() && source[i + 1] == ':')
+        {
+          size_t end = source.find(":]", i + 2);
+          if (end != string::npos)
+            {
+              string name = source.substr(i + 2, end - i - 2);
+              for (size_t k = 0; k < sizeof(named_classes) / sizeof(named_classes[0]); ++k)
+                {
+                  if (name == named_classes[k].name)
+                    {
+                      for (int x = 0; x < 256; ++x)
+                        {
+                          if (named_classes[k].is_member(x))
+                            {
+                              chars.set(x);
+                            }
+                        }
+                    }
+                }
+              i = end + 2;
+              continue;
+            }
+        }
+
+      if (c == '\\')
+        {
+          if (i + 1 == source.size())
+            {
+              return match_nothing(source, token);
+            }
+          ++i;
+        }
+      unsigned char low = source[i];
+      ++i;
+
+      // Range, eg a-z
+      unsigned char high = low;
+      if (i < source.size() && source[i] == '-'
+          && (i + 1 == source.size() || source[i + 1] != ']'))
+        {
+          ++i;
+          if (i < source.size() && source[i] == '\\')
+            {
+              ++i;
+            }
+          if (i == source.size())
+            {
+              // Range without end
+              return match_nothing(source, token);
+            }
+          high = source[i];
+          ++i;
+        }
+      for (unsigned int x = low; x <= high; ++x)
+        {
+          chars.set(x);
+        }
+    }
+  return string::npos;
+}
+
+/*****************************************************************************/
+void T_glob_set::add_state(uint32_t pattern, uint32_t position,
+                           vector<T_state>& states) const
+{
+  // A '*' may match the empty string: next token is active as well
+  const vector<T_token>& tokens = _patterns[pattern].tokens;
+  states.push_back(T_state(pattern, position));
+  while (position < tokens.size() && tokens[position].kind == T_token::ANY_STRING)
+    {
+      ++position;
+      states.push_back(T_state(pattern, position));
+    }
+}
+
+/*****************************************************************************/
+void T_glob_set::run(const string& text, T_run& result) const
+{
+  result.states.clear();
+  result.in_trie = not _trie.empty();
+  result.node = 0;
+  if (not result.in_trie)
+    {
+      return;
+    }
+
+  BOOST_FOREACH(uint32_t pattern_id, _trie[0].patterns)
+    {
+      add_state(pattern_id, 0, result.states);
+    }
+
+  vector<T_state> next;
+  for (size_t i = 0; i < text.size(); ++i)
+    {
+      if (result.states.empty() && not result.in_trie)
+        {
+          return; // no pattern can match anymore
+        }
+
+      unsigned char c = text[i];
+      if (not _is_case_sensitive)
+        {
+          c = tolower(c);
+        }
+
+      next.clear();
+      BOOST_FOREACH(const T_state& state, result.states)
+        {
+          const vector<T_token>& tokens = _patterns[state.first].tokens;
+          if (state.second == tokens.size())
+            {
+              continue;
+            }
+          const T_token& token = tokens[state.second];
+          switch (token.kind)
+            {
+            case T_token::ANY_STRING:
+              add_state(state.first, state.second, next);
+              break;
+            case T_token::ANY_CHAR:
+              add_state(state.first, state.second + 1, next);
+              break;
+            case T_token::CHAR:
+              if (token.c == c)
+                {
+                  add_state(state.first, state.second + 1, next);
+                }
+              break;
+            case T_token::CLASS:
+              if (token.chars.test(c))
+                {
+                  add_state(state.first, state.second + 1, next);
+                }
+              break;
+            }
+        }
+
+      if (result.in_trie)
+        {
+          const T_trie_node& node = _trie[result.node];
+          map<unsigned char, uint32_t>::const_iterator child = node.children.find(c);
+          if (child == node.children.end())
+            {
+              result.in_trie = false;
+            }
+          else
+            {
+              result.node = child->second;
+              BOOST_FOREACH(uint32_t pattern_id, _trie[result.node].patterns)
+                {
+                  add_state(pattern_id, _patterns[pattern_id].prefix_length, next);
+                }
+            }
+        }
+
+      sort(next.begin(), next.end());
+      next.erase(unique(next.begin(), next.end()), next.end());
+      result.states.swap(next);
+    }
+}
+
+/*****************************************************************************/
+bool T_glob_set::match(const string& path) const
+{
+  T_run result;
+  run(path, result);
+  BOOST_FOREACH(const T_state& state, result.states)
+    {
+      if (state.second == _patterns[state.first].tokens.size())
+        {
+          LOG(INFO, 7) << "Path matched pattern: " << _patterns[state.first].source;
+          return true;
+        }
+    }
+  return false;
+}
+
+/*****************************************************************************/
+bool T_glob_set::may_match_under(const string& prefix) const
+{
+  T_run result;
+  run(prefix, result);
+  if (result.in_trie && not _trie[result.node].children.empty())
+    {
+      return true;
+    }
+  BOOST_FOREACH(const T_state& state, result.states)
+    {
+      if (state.second < _patterns[state.first].tokens.size())
+        {
+          return true;
+        }
+    }
+  return false;
+}
+
+/*****************************************************************************/
+bool T_glob_set::match_all_under(const string& prefix) const
+{
+  T_run result;
+  run(prefix, result);
+  BOOST_FOREACH(const T_state& state, result.states)
+    {
+      const T_pattern& pattern = _patterns[state.first];
+      if (state.second >= pattern.star_suffix
+          && state.second < pattern.tokens.size())
+        {
+          LOG(INFO, 7) << "Subtree matched pattern: " << pattern.source;
+          return true;
+        }
+    }
+  return false;
+}
+
+/*****************************************************************************/
+T_path_filter::T_path_filter(bool case_sensitive)
+  : _includes(case_sensitive), _excludes(case_sensitive)
+{
+}
+
+void
+T_path_filter::set_excluded_patterns(const std::list< string >& patterns)
+{
+  _excludes.compile(patterns);
+  LOG(INFO, 7) << "Excluded patterns: "
+               << makeIteratorLogger(patterns.begin(), patterns.end());
+}
+
+void
+T_path_filter::set_included_patterns(const std::list< string >& patterns)
+{
+  _includes.compile(patterns);
+  LOG(INFO, 7) << "Included patterns: "
+               << makeIteratorLogger(patterns.begin(), patterns.end());
+}
+
+bool
+T_path_filter::accept(const string& path) const
+{
+  LOG(INFO, 7) << "Checking path filter for: " << path;
+  return (not _excludes.match(path)
+          && (_includes.empty() || _includes.match(path)));
+}
+
+bool
+T_path_filter::is_subtree_excluded(const string& directory_path) const
+{
+  string prefix(directory_path);
+  if (prefix.empty() || *prefix.rbegin() != '/')
+    {
+      prefix += '/';
+    }
+  return (_excludes.match_all_under(prefix)
+          || (not _includes.empty() && not _includes.may_match_under(prefix)));
+}
@@ -0,0 +1,136 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Compiled path filters
+ *
+ ***************************************************************************/
+#ifndef _FILESYSTEM_FILTER_H_
+#define _FILESYSTEM_FILTER_H_
+
+#include <COMMON/META/antidot.h>
+
+#include <bitset>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+/*****************************************************************************/
+//! @brief A set of fnmatch() patterns compiled into a single automaton
+//! Patterns follow fnmatch() rules without flags: '*' and '?' also match '/'.
+//! Literal pattern prefixes are shared in a trie, remaining parts are run
+//! together as a non-deterministic automaton: a path is matched against all
+//! patterns in a single pass. All const methods are thread-safe.
+class T_glob_set
+{
+public:
+  T_glob_set(bool case_sensitive = true);
+
+  //! @brief Replace the set content by the given patterns
+  void compile(const std::list<std::string>& patterns);
+
+  bool empty() const { return _patterns.empty(); }
+
+  //! @brief Returns true if path matches at least one pattern
+  bool match(const std::string& path) const;
+
+  //! @brief Returns true if some path starting with prefix may match
+  bool may_match_under(const std::string& prefix) const;
+
+  //! @brief Returns true if every path longer than prefix and starting with
+  //! prefix matches (ie a pattern ends with '*' once prefix is read)
+  bool match_all_under(const std::string& prefix) const;
+
+private:
+  struct T_token
+  {
+    enum Kind { CHAR, ANY_CHAR, ANY_STRING, CLASS };
+    Kind                kind;
+    unsigned char       c;
+    std::bitset<256>    chars;
+  };
+
+  struct T_pattern
+  {
+    std::string           source;
+    std::vector<T_token>  tokens;
+    size_t                prefix_length; // leading CHAR tokens, in the trie
+    size_t                star_suffix;   // tokens from here are all '*'
+  };
+
+  struct T_trie_node
+  {
+    std::map<unsigned char, uint32_t> children;
+    std::vector<uint32_t>             patterns; // prefix ends on this node
+  };
+
+  // Automaton state: position in a pattern
+  typedef std::pair<uint32_t, uint32_t> T_state;
+
+  //! @brief Result of reading a text
+  struct T_run
+  {
+    std::vector<T_state>  states;     // states after last char
+    bool                  in_trie;    // text is a prefix of a trie path
+    uint32_t              node;       // trie node if in_trie
+  };
+
+  bool                      _is_case_sensitive;
+  std::vector<T_pattern>    _patterns;
+  std::vector<T_trie_node>  _trie;
+
+  static T_pattern parse(const std::string& source);
+  //! @brief Parse a bracket expression into a CLASS token
+  //! @return position after the expression, npos if it is unterminated (the
+  //! '[' is then a literal)
+  static size_t parse_class(const std::string& source, size_t pos, T_token& token);
+  //! @brief Bracket expressions fnmatch() never matches (escape or range cut
+  //! by the end of the pattern): a class without any character, which
+  //! consumes the rest of the pattern
+  static size_t match_nothing(const std::string& source, T_token& token);
+  void add_state(uint32_t pattern, uint32_t position,
+                 std::vector<T_state>& states) const;
+  void run(const std::string& text, T_run& result) const;
+};
+
+/*****************************************************************************/
+//! @brief Include/exclude filter on paths, case insensitive for SMB
+class T_path_filter
+{
+public:
+  T_path_filter(bool case_sensitive = true);
+
+  void set_excluded_patterns(const std::list<std::string>& patterns);
+  void set_included_patterns(const std::list<std::string>& patterns);
+
+  bool accept(const std::string& path) const;
+
+  //! @brief Returns true if no path under the directory can be accepted,
+  //! so that the directory does not need to be listed
+  bool is_subtree_excluded(const std::string& directory_path) const;
+
+private:
+  T_glob_set _includes;
+  T_glob_set _excludes;
+};
+
+#endif // _FILESYSTEM_FILTER_H_
@@ -0,0 +1,183 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Filesystem proxy recording the metrics of its calls
+ *
+ ***************************************************************************/
+
+#include "fs_instrumented.h"
+
+using namespace N_Security;
+
+/*****************************************************************************/
+T_instrumented_filesystem::T_instrumented_filesystem(T_filesystem_config_ptr conf,
+                                                     T_filesystem_proxy* target,
+                                                     T_filesystem_metrics& metrics)
+  : T_filesystem_proxy(conf),
+    _target(target),
+    _metrics(metrics)
+{
+}
+
+T_instrumented_filesystem::~T_instrumented_filesystem()
+{
+}
+
+/*****************************************************************************/
+void T_instrumented_filesystem::connect()
+{
+  _target->connect();
+}
+
+void T_instrumented_filesystem::disconnect()
+{
+  _target->disconnect();
+}
+
+/*****************************************************************************/
+T_url_ptr
+T_instrumented_filesystem::create_url(const N_Uri::T_uri& uri) const
+{
+  return _target->create_url(uri);
+}
+
+T_url_ptr
+T_instrumented_filesystem::create_url(const std::string& fs_path) const
+{
+  return _target->create_url(fs_path);
+}
+
+T_url_ptr
+T_instrumented_filesystem::create_entry_url(const T_url& directory,
+                                            const std::string& fs_path) const
+{
+  return _target->create_entry_url(directory, fs_path);
+}
+
+/*****************************************************************************/
+bool T_instrumented_filesystem::check_if_file_exists(const T_url& url)
+{
+  T_timed_operation timer(_metrics[T_filesystem_metrics::EXISTS]);
+  bool exists = _target->check_if_file_exists(url);
+  timer.done();
+  return exists;
+}
+
+/*****************************************************************************/
+void T_instrumented_filesystem::list_directory(const T_url& url,
+                                               T_directory_entries& entries)
+{
+  T_timed_operation timer(_metrics[T_filesystem_metrics::READDIR]);
+  _target->list_directory(url, entries);
+  timer.done(0, entries.size());
+}
+
+/*****************************************************************************/
+bool T_instrumented_filesystem::read_file_content(const T_url& url,
+                                                  const T_file_info& info,
+                                                  std::string& data,
+                                                  uint64_t max_size)
+{
+  T_timed_operation timer(_metrics[T_filesystem_metrics::READ]);
+  bool complete = _target->read_file_content(url, info, data, max_size);
+  timer.done(data.size());
+  return complete;
+}
+
+/*****************************************************************************/
+uint32_t T_instrumented_filesystem::io_batch_size() const
+{
+  return _target->io_batch_size();
+}
+
+/*****************************************************************************/
+void
+T_instrumented_filesystem::read_files_content(std::vector<T_content_read>& reads,
+                                              uint64_t max_size)
+{
+  T_timed_operation timer(_metrics[T_filesystem_metrics::READ]);
+  _target->read_files_content(reads, max_size);
+  uint64_t bytes = 0;
+  uint64_t nb_errors = 0;
+  for (size_t i = 0; i < reads.size(); ++i)
+    {
+      bytes += reads[i].data->size();
+      nb_errors += reads[i].error.empty() ? 0 : 1;
+    }
+  timer.done(bytes, reads.size(), nb_errors);
+}
+
+/*****************************************************************************/
+ACL T_instrumented_filesystem::read_url_permissions(const T_url& url)
+{
+  T_timed_operation timer(_metrics[T_filesystem_metrics::PERMISSIONS]);
+  ACL acl = _target->read_url_permissions(url);
+  timer.done();
+  return acl;
+}
+
+ACL T_instrumented_filesystem::read_url_permissions(const string& localpath)
+{
+  T_timed_operation timer(_metrics[T_filesystem_metrics::PERMISSIONS]);
+  ACL acl = _target->read_url_permissions(localpath);
+  timer.done();
+  return acl;
+}
+
+/*****************************************************************************/
+void T_instrumented_filesystem::read_file_info(const T_url& url,
+                                               T_file_info& info)
+{
+  T_timed_operation timer(_metrics[T_filesystem_metrics::STAT]);
+  _target->read_file_info(url, info);
+  timer.done();
+}
+
+/*****************************************************************************/
+void
+T_instrumented_filesystem::read_entries_info(const T_url& directory,
+                                             T_directory_entries& entries,
+                                             const std::vector<size_t>& indices)
+{
+  size_t nb_missing = 0;
+  for (size_t i = 0; i < indices.size(); ++i)
+    {
+      nb_missing += entries.info(indices[i]).has_attributes ? 0 : 1;
+    }
+
+  T_timed_operation timer(_metrics[T_filesystem_metrics::STAT]);
+  _target->read_entries_info(directory, entries, indices);
+  size_t nb_filled = nb_missing;
+  for (size_t i = 0; i < indices.size(); ++i)
+    {
+      nb_filled -= entries.info(indices[i]).has_attributes ? 0 : 1;
+    }
+  // Filesystems which do not batch leave attributes to read_file_info()
+  if (nb_filled > 0)
+    {
+      timer.done(0, nb_missing, nb_missing - nb_filled);
+    }
+  else
+    {
+      timer.cancel();
+    }
+}
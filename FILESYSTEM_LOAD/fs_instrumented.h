@@ -0,0 +1,80 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Filesystem proxy recording the metrics of its calls
+ *
+ ***************************************************************************/
+
+#ifndef _FILESYSTEM_INSTRUMENTED_H_
+#define _FILESYSTEM_INSTRUMENTED_H_
+
+#include "fs_proxy.h"
+#include "fs_metrics.h"
+
+#include <boost/scoped_ptr.hpp>
+
+/*****************************************************************************/
+//! @brief Forwards all calls to a filesystem proxy and records their
+//! latency, bytes and errors (readdir, stat, read, permissions, exists)
+//! URLs are the ones of the wrapped proxy.
+class T_instrumented_filesystem : public T_filesystem_proxy
+{
+public:
+  //! @param target wrapped proxy, owned
+  T_instrumented_filesystem(T_filesystem_config_ptr conf,
+                            T_filesystem_proxy* target,
+                            T_filesystem_metrics& metrics);
+  virtual ~T_instrumented_filesystem();
+
+  //! @brief The wrapped proxy
+  T_filesystem_proxy& target() { return *_target; }
+
+  virtual void connect();
+  virtual void disconnect();
+
+  virtual T_url_ptr create_url(const N_Uri::T_uri& uri) const;
+  virtual T_url_ptr create_url(const std::string& fs_path) const;
+  virtual T_url_ptr create_entry_url(const T_url& directory,
+                                     const std::string& fs_path) const;
+  virtual bool check_if_file_exists(const T_url& url);
+  virtual void list_directory(const T_url& url,
+                              T_directory_entries& entries);
+  virtual bool read_file_content(const T_url& url,
+                                 const T_file_info& info,
+                                 std::string& data,
+                                 uint64_t max_size);
+  virtual uint32_t io_batch_size() const;
+  virtual void read_files_content(std::vector<T_content_read>& reads,
+                                  uint64_t max_size);
+  virtual N_Security::ACL read_url_permissions(const T_url& url);
+  virtual N_Security::ACL read_url_permissions(const string& localpath);
+  virtual void read_file_info(const T_url& url, T_file_info& info);
+  virtual void read_entries_info(const T_url& directory,
+                                 T_directory_entries& entries,
+                                 const std::vector<size_t>& indices);
+
+private:
+  boost::scoped_ptr<T_filesystem_proxy> _target;
+  T_filesystem_metrics&                 _metrics;
+};
+
+#endif // _FILESYSTEM_INSTRUMENTED_H_
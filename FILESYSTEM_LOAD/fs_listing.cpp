@@ -0,0 +1,255 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Persistent cache of directory listings
+ *
+ ***************************************************************************/
+
+#include "fs_listing.h"
+
+#include <COMMON/BASIC/log.h>
+
+#include <boost/foreach.hpp>
+
+#include <errno.h>
+#include <stdio.h>
+
+#include <fstream>
+
+using namespace boost;
+
+namespace {
+  static const char listing_magic[8] = { 'A', 'F', 'S', 'F', 'S', 'L', 'S', 'T' };
+  static const uint32_t listing_version = 1;
+  // Directories modified less than this before their listing (seconds) are
+  // not cached: covers changes in the same second and clock skew with the
+  // server
+  static const time_t unreliable_mtime_margin = 3600;
+
+  template <class T>
+  inline void write_value(std::ostream& out, const T& value)
+  {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  template <class T>
+  inline bool read_value(std::istream& in, T& value)
+  {
+    return in.read(reinterpret_cast<char*>(&value), sizeof(value)).good();
+  }
+
+  //! @brief True if a directory is one of the roots or under one of them
+  bool is_under_root(const std::string& directory_path,
+                     const std::set<std::string>& root_paths)
+  {
+    BOOST_FOREACH(const std::string& root, root_paths)
+      {
+        if (directory_path.compare(0, root.size(), root) == 0
+            && (directory_path.size() == root.size()
+                || directory_path[root.size()] == '/'
+                || (not root.empty() && root[root.size() - 1] == '/')))
+          {
+            return true;
+          }
+      }
+    return false;
+  }
+
+  inline void write_string(std::ostream& out, const char* data, size_t size)
+  {
+    write_value(out, static_cast<uint32_t>(size));
+    out.write(data, size);
+  }
+
+  inline void write_string(std::ostream& out, const std::string& value)
+  {
+    write_string(out, value.data(), value.size());
+  }
+
+  inline bool read_string(std::istream& in, std::string& value)
+  {
+    uint32_t size;
+    if (not read_value(in, size))
+      {
+        return false;
+      }
+    value.resize(size);
+    return (size == 0) || in.read(&value[0], size).good();
+  }
+} // namespace
+
+/*****************************************************************************/
+T_listing_cache::T_listing_cache(const std::string& filepath)
+  : _filepath(filepath)
+{
+  load();
+}
+
+/*****************************************************************************/
+void T_listing_cache::load()
+{
+  std::ifstream in(_filepath.c_str(), std::ios::binary);
+  if (not in)
+    {
+      return;
+    }
+
+  char magic[sizeof(listing_magic)];
+  uint32_t version;
+  uint64_t nb_listings;
+  if (not in.read(magic, sizeof(magic))
+      || memcmp(magic, listing_magic, sizeof(magic)) != 0
+      || not read_value(in, version) || version != listing_version
+      || not read_value(in, nb_listings))
+    {
+      LOG(WARNING, 2) << "Invalid listing cache, ignored: " << _filepath;
+      return;
+    }
+
+  for (uint64_t i = 0; i < nb_listings; ++i)
+    {
+      std::string directory_path;
+      int64_t mtime;
+      uint32_t nb_entries;
+      if (not read_string(in, directory_path)
+          || not read_value(in, mtime)
+          || not read_value(in, nb_entries))
+        {
+          break;
+        }
+      T_listing& listing = _listings[directory_path];
+      listing.mtime = mtime;
+      listing.entries.reserve(nb_entries, 0);
+      std::string name;
+      for (uint32_t j = 0; j < nb_entries; ++j)
+        {
+          uint8_t type;
+          if (not read_value(in, type) || not read_string(in, name))
+            {
+              LOG(WARNING, 2) << "Truncated listing cache, ignored: " << _filepath;
+              _listings.clear();
+              return;
+            }
+          listing.entries.add(name, static_cast<T_file_info::Type>(type));
+        }
+    }
+  LOG(INFO, 4) << "Listing cache loaded: " << _filepath
+               << " (" << _listings.size() << " directories)";
+}
+
+/*****************************************************************************/
+bool T_listing_cache::get(const std::string& directory_path,
+                          time_t mtime,
+                          T_directory_entries& entries) const
+{
+  mutex::scoped_lock lock(_mutex);
+  T_listings::const_iterator it = _listings.find(directory_path);
+  if (it == _listings.end() || it->second.mtime != mtime)
+    {
+      return false;
+    }
+  entries = it->second.entries;
+  return true;
+}
+
+/*****************************************************************************/
+void T_listing_cache::put(const std::string& directory_path,
+                          time_t mtime,
+                          time_t listing_time,
+                          const T_directory_entries& entries)
+{
+  mutex::scoped_lock lock(_mutex);
+  if (mtime + unreliable_mtime_margin >= listing_time)
+    {
+      _listings.erase(directory_path);
+      return;
+    }
+  T_listing& listing = _listings[directory_path];
+  listing.mtime = mtime;
+  listing.entries = entries;
+  for (size_t i = 0; i < listing.entries.size(); ++i)
+    {
+      // Attributes would be stale when the listing is reused
+      listing.entries.info(i) = T_file_info(entries.info(i).type);
+    }
+}
+
+/*****************************************************************************/
+void T_listing_cache::save(const T_crawl_manifest& manifest,
+                           const std::set<std::string>& root_paths)
+{
+  mutex::scoped_lock lock(_mutex);
+
+  // Directories of the crawled roots not listed by the run are gone or
+  // excluded; directories of the other roots are kept for their next run
+  for (T_listings::iterator it = _listings.begin(); it != _listings.end(); )
+    {
+      if (is_under_root(it->first, root_paths)
+          && not manifest.is_listed(it->first))
+        {
+          it = _listings.erase(it);
+        }
+      else
+        {
+          ++it;
+        }
+    }
+
+  std::string tmp_filepath = _filepath + ".tmp";
+  {
+    std::ofstream out(tmp_filepath.c_str(), std::ios::binary | std::ios::trunc);
+    out.write(listing_magic, sizeof(listing_magic));
+    write_value(out, listing_version);
+    write_value(out, static_cast<uint64_t>(_listings.size()));
+    BOOST_FOREACH(const T_listings::value_type& item, _listings)
+      {
+        write_string(out, item.first);
+        write_value(out, static_cast<int64_t>(item.second.mtime));
+        write_value(out, static_cast<uint32_t>(item.second.entries.size()));
+        const T_directory_entries& entries = item.second.entries;
+        for (size_t i = 0; i < entries.size(); ++i)
+          {
+            write_value(out, static_cast<uint8_t>(entries.info(i).type));
+            write_string(out, entries.name_data(i), entries.name_length(i));
+          }
+      }
+    out.close();
+    if (out.fail())
+      {
+        throw E_system("Could not write listing cache: " + tmp_filepath);
+      }
+  }
+  if (rename(tmp_filepath.c_str(), _filepath.c_str()) < 0)
+    {
+      throw E_system("Could not replace listing cache: " + _filepath
+                     + ": " + strerror(errno));
+    }
+  LOG(INFO, 4) << "Listing cache saved: " << _filepath
+               << " (" << _listings.size() << " directories)";
+}
+
+/*****************************************************************************/
+size_t T_listing_cache::size() const
+{
+  mutex::scoped_lock lock(_mutex);
+  return _listings.size();
+}
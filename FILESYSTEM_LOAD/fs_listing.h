@@ -0,0 +1,91 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Persistent cache of directory listings
+ *
+ ***************************************************************************/
+#ifndef _FILESYSTEM_LISTING_H_
+#define _FILESYSTEM_LISTING_H_
+
+#include "fs_proxy.h"
+#include "fs_manifest.h"
+
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <set>
+
+/*****************************************************************************/
+//! @brief Listings of the directories crawled by previous runs
+//! A directory mtime changes when entries are added, removed or renamed:
+//! while it does not move, its previous listing can be reused. Only names
+//! and types of entries are kept, their attributes are read again.
+//! Loaded in memory at creation, written back by save(). Thread-safe.
+class T_listing_cache
+{
+public:
+  //! @brief Load the cache file if it exists
+  T_listing_cache(const std::string& filepath);
+
+  //! @brief Get the listing of a directory if its mtime did not change
+  //! @param entries (out) entries, without attributes
+  //! @return false if the directory is unknown or was modified
+  bool get(const std::string& directory_path,
+           time_t mtime,
+           T_directory_entries& entries) const;
+
+  //! @brief Record the listing of a directory
+  //! @param listing_time when the listing started (client clock): mtimes
+  //! close to it are not reliable, as a later change in the same second
+  //! keeps the mtime and the server clock may differ from the client one
+  void put(const std::string& directory_path,
+           time_t mtime,
+           time_t listing_time,
+           const T_directory_entries& entries);
+
+  //! @brief Write the cache file. Directories under the crawled roots are
+  //! only kept if they were listed by the run, the others are kept as is.
+  //! @param manifest frozen manifest of the run
+  //! @param root_paths local paths of the roots crawled by the run
+  //! @exception E_system if the file cannot be written
+  void save(const T_crawl_manifest& manifest,
+            const std::set<std::string>& root_paths);
+
+  //! @brief Number of cached directories
+  size_t size() const;
+
+private:
+  struct T_listing
+  {
+    time_t              mtime;
+    T_directory_entries entries; // types only
+  };
+  typedef boost::unordered_map<std::string, T_listing> T_listings;
+
+  std::string           _filepath;
+  mutable boost::mutex  _mutex;
+  T_listings            _listings;
+
+  void load();
+};
+
+#endif // _FILESYSTEM_LISTING_H_
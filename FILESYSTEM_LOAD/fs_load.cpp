@@ -25,8 +25,11 @@ https://github.com/antidot/AIF-Filters/
  ****************************************************************************/
 
 #include "fs_load.h"
+#include "fs_filter.h"
 #include "fs_mount.h"
 #include "fs_samba.h"
+#include "fs_digest.h"
+#include "fs_instrumented.h"
 
 #include <PaF/API/PIPE/pipe.h>
 
@@ -36,16 +39,46 @@ https://github.com/antidot/AIF-Filters/
 #include <COMMON/BASIC/log.h>
 #include <COMMON/META/antidot.h>
 
+#include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/foreach.hpp>
 #include <boost/algorithm/string/case_conv.hpp>
 
 #include <sys/file.h>
-#include <fnmatch.h>
+
+#include <algorithm>
+#include <limits>
 
 using namespace N_Security;
 using namespace boost;
 
+namespace {
+  //! @brief Parse an unsigned integer argument, digits only
+  //! lexical_cast accepts a leading sign and wraps "-1" around.
+  //! @exception bad_lexical_cast if not a number or out of range
+  template <class T>
+  T parse_unsigned(const string& value)
+  {
+    if (value.empty() || value.find_first_not_of("0123456789") != string::npos)
+      {
+        throw bad_lexical_cast();
+      }
+    return lexical_cast<T>(value);
+  }
+} // namespace
+
+/*****************************************************************************/
+T_filesystem_load_stats::T_filesystem_load_stats()
+  : _nb_directories(0),
+    _nb_new_files(0),
+    _nb_updated_files(0),
+    _nb_unchanged_files(0),
+    _nb_same_content_files(0),
+    _nb_cached_listings(0),
+    _nb_deleted_files(0),
+    _nb_failed_directories(0)
+{
+}
 
 /*****************************************************************************/
 void T_filesystem_load::log_stats()
@@ -57,6 +90,33 @@ void T_filesystem_load::log_stats()
         << ((_stats._nb_directories > 1) ? "ies" : "y");
     _handle.log(N_Event::INFO, msg.str());
   }
+  if (_stats._nb_cached_listings > 0)
+    {
+      ostringstream msg;
+      msg << "Reused " << _stats._nb_cached_listings
+          << " listing(s) of unchanged directories";
+      _handle.log(N_Event::INFO, msg.str());
+    }
+  if (_stats._nb_unchanged_files > 0)
+    {
+      ostringstream msg;
+      msg << "Skipped " << _stats._nb_unchanged_files << " unchanged file(s)";
+      _handle.log(N_Event::INFO, msg.str());
+    }
+  if (_stats._nb_same_content_files > 0)
+    {
+      ostringstream msg;
+      msg << "Kept the content of " << _stats._nb_same_content_files
+          << " modified file(s) with the same content";
+      _handle.log(N_Event::INFO, msg.str());
+    }
+  if (_stats._nb_failed_directories > 0)
+    {
+      ostringstream msg;
+      msg << "Could not crawl " << _stats._nb_failed_directories
+          << " director" << ((_stats._nb_failed_directories > 1) ? "ies" : "y");
+      _handle.log(N_Event::WARNING, msg.str());
+    }
   if (_stats._nb_deleted_files > 0)
     {
       ostringstream msg;
@@ -65,6 +125,31 @@ void T_filesystem_load::log_stats()
     }
 }
 
+/*****************************************************************************/
+void T_filesystem_load::report_metrics()
+{
+  vector<string> lines;
+  _metrics.format(lines);
+
+  mutex::scoped_lock lock(_handle_mutex);
+  BOOST_FOREACH(const string& line, lines)
+    {
+      _handle.log(N_Event::INFO, line);
+    }
+  if (not _metrics_file.empty())
+    {
+      try
+        {
+          _metrics.save(_metrics_file);
+        }
+      catch(E_system& e)
+        {
+          _handle.log(N_Event::WARNING, "Could not save metrics ["
+                                        + string(e.what()) + "]");
+        }
+    }
+}
+
 /*****************************************************************************/
 T_filesystem_load::T_filesystem_load(AFS::PaF::Configuration& configuration, 
                        AFS::PaF::Handle& handle)
@@ -72,7 +157,19 @@ T_filesystem_load::T_filesystem_load(AFS::PaF::Configuration& configuration,
     _fs_type(N_Uri::NFS),
     _output_type(N_PaF::N_Layer::CONTENTS),
     _skip_non_readable_files(true),
-    _stats()
+    _max_file_size(0),
+    _oversized_files(SKIP_OVERSIZED),
+    _crawl_threads(1),
+    _crawl_order(T_crawler::DEPTH_FIRST),
+    _crawl_max_frontier(100000),
+    _prefetch_batch_size(1000),
+    _prefetch_disabled(false),
+    _prefetch_verified(false),
+    _read_ahead_depth(4),
+    _read_ahead_bytes(64 * 1024 * 1024),
+    _stats(),
+    _metrics_interval(0),
+    _run_failed(false)
 {
   LOG(INFO, 9) << "T_filesystem_load::T_filesystem_load()";
 }
@@ -81,6 +178,9 @@ T_filesystem_load::T_filesystem_load(AFS::PaF::Configuration& configuration,
 T_filesystem_load::~T_filesystem_load()
 {
   LOG(INFO, 9) << "T_filesystem_load::~T_filesystem_load()";
+
+  end_of_run();
+
   if (_fs_proxy.get())
   {
     _handle.log(N_Event::INFO, "Disconnecting from filesystem...");
@@ -93,6 +193,8 @@ T_filesystem_load::~T_filesystem_load()
   }
 
   log_stats();
+  _metrics_reporter.reset();
+  report_metrics();
 }
 
 /*****************************************************************************/
@@ -101,6 +203,18 @@ void T_filesystem_load::init()
   LOG(INFO, 9) << "T_nfs_load::init()";
 
   static const string skip_non_readable_files_arg_name("skip_non_readable_files");
+  static const string crawl_threads_arg_name("crawl_threads");
+  static const string crawl_order_arg_name("crawl_order");
+  static const string crawl_max_frontier_arg_name("crawl_max_frontier");
+  static const string max_file_size_arg_name("max_file_size");
+  static const string oversized_files_arg_name("oversized_files");
+  static const string state_index_file_arg_name("state_index_file");
+  static const string prefetch_batch_size_arg_name("prefetch_batch_size");
+  static const string listing_cache_file_arg_name("listing_cache_file");
+  static const string read_ahead_depth_arg_name("read_ahead_depth");
+  static const string read_ahead_bytes_arg_name("read_ahead_bytes");
+  static const string metrics_interval_arg_name("metrics_interval");
+  static const string metrics_file_arg_name("metrics_file");
 
   // Output layer
   _output_type = _configuration.get_output_type(N_PaF::N_Layer::CONTENTS);
@@ -125,19 +239,176 @@ void T_filesystem_load::init()
   _handle.log(N_Event::INFO, "Filter argument: " + skip_non_readable_files_arg_name
                + " = " + to_string(_skip_non_readable_files));
 
+  // Maximum size of loaded files, and what to do with larger files
+  _max_file_size = get_unsigned_arg(max_file_size_arg_name, 0,
+                                    numeric_limits<uint64_t>::max(),
+                                    _max_file_size);
+
+  if (_configuration.has_arg(oversized_files_arg_name))
+    {
+      string oversized_files_str = _configuration.get_string(oversized_files_arg_name);
+      to_lower(oversized_files_str);
+      if (oversized_files_str == "skip")
+        {
+          _oversized_files = SKIP_OVERSIZED;
+        }
+      else if (oversized_files_str == "truncate")
+        {
+          _oversized_files = TRUNCATE_OVERSIZED;
+        }
+      else if (oversized_files_str == "ko")
+        {
+          _oversized_files = KO_OVERSIZED;
+        }
+      else
+        {
+          _handle.log(N_Event::FATAL, "Filter argument: " + oversized_files_arg_name
+                      + ": '" + oversized_files_str + "' invalid value");
+        }
+      _handle.log(N_Event::INFO, "Filter argument: " + oversized_files_arg_name
+                   + " = " + oversized_files_str);
+    }
+
+  // Number of crawl workers
+  _crawl_threads = get_unsigned_arg(crawl_threads_arg_name, 0,
+                                    numeric_limits<uint32_t>::max(),
+                                    _crawl_threads);
+  if (_crawl_threads == 0)
+    {
+      _crawl_threads = 1;
+    }
+
+  // Crawl order and memory bound
+  if (_configuration.has_arg(crawl_order_arg_name))
+    {
+      string crawl_order_str = _configuration.get_string(crawl_order_arg_name);
+      to_lower(crawl_order_str);
+      if (crawl_order_str == "depth_first")
+        {
+          _crawl_order = T_crawler::DEPTH_FIRST;
+        }
+      else if (crawl_order_str == "breadth_first")
+        {
+          _crawl_order = T_crawler::BREADTH_FIRST;
+        }
+      else
+        {
+          _handle.log(N_Event::FATAL, "Filter argument: " + crawl_order_arg_name
+                      + ": '" + crawl_order_str + "' invalid value");
+        }
+      _handle.log(N_Event::INFO, "Filter argument: " + crawl_order_arg_name
+                   + " = " + crawl_order_str);
+    }
+
+  _crawl_max_frontier = get_unsigned_arg(crawl_max_frontier_arg_name, 0,
+                                         numeric_limits<uint32_t>::max(),
+                                         _crawl_max_frontier);
+
+  // Number of documents fetched from PaF by a single query
+  _prefetch_batch_size = get_unsigned_arg(prefetch_batch_size_arg_name, 0,
+                                          numeric_limits<uint32_t>::max(),
+                                          _prefetch_batch_size);
+
+  // Files read while the previous ones are sent
+  _read_ahead_depth = get_unsigned_arg(read_ahead_depth_arg_name, 0,
+                                       numeric_limits<uint32_t>::max(),
+                                       _read_ahead_depth);
+
+  _read_ahead_bytes = get_unsigned_arg(read_ahead_bytes_arg_name, 0,
+                                       numeric_limits<uint64_t>::max(),
+                                       _read_ahead_bytes);
+
+  // Latencies of filesystem and PaF calls, logged at the end of the run
+  _metrics_interval = get_unsigned_arg(metrics_interval_arg_name, 0,
+                                       numeric_limits<uint32_t>::max(),
+                                       _metrics_interval);
+
+  if (_configuration.has_arg(metrics_file_arg_name))
+    {
+      _metrics_file = _configuration.get_string(metrics_file_arg_name);
+      _handle.log(N_Event::INFO, "Filter argument: " + metrics_file_arg_name
+                   + " = " + _metrics_file);
+    }
+
   // Secured mode
   if (AFS::PaF::Pipe::pipe().is_secured())
     {
       _handle.log(N_Event::INFO, "Filter is running in SECURED mode");
     }
 
+  // Index of files loaded by previous runs
+  if (_configuration.has_arg(state_index_file_arg_name))
+    {
+      string state_index_file = _configuration.get_string(state_index_file_arg_name);
+      _handle.log(N_Event::INFO, "Filter argument: " + state_index_file_arg_name
+                   + " = " + state_index_file);
+      _state_index.reset(new T_crawl_state_index(state_index_file));
+      _handle.log(N_Event::INFO, "Crawl state index: "
+                  + N_String::to_string(_state_index->size()) + " file(s)");
+      if (AFS::PaF::Pipe::pipe().is_secured())
+        {
+          // SAR of unchanged files depends on their parents permissions
+          _handle.log(N_Event::WARNING, "Unchanged files are loaded anyway"
+                      " in SECURED mode");
+        }
+    }
+
+  // Listings of directories crawled by previous runs
+  if (_configuration.has_arg(listing_cache_file_arg_name))
+    {
+      string listing_cache_file = _configuration.get_string(listing_cache_file_arg_name);
+      _handle.log(N_Event::INFO, "Filter argument: " + listing_cache_file_arg_name
+                   + " = " + listing_cache_file);
+      _listing_cache.reset(new T_listing_cache(listing_cache_file));
+      _handle.log(N_Event::INFO, "Listing cache: "
+                  + N_String::to_string(_listing_cache->size()) + " director(ies)");
+    }
+
   create_filesystem_proxy();
   create_acl_provider();
 
   _handle.log(N_Event::INFO, "Connecting to filesystem...");
   _fs_proxy->connect();
   _handle.log(N_Event::INFO, "OK - Connected");
+
+  if (_metrics_interval > 0)
+    {
+      _metrics_reporter.reset(new T_metrics_reporter(
+          bind(&T_filesystem_load::report_metrics, this), _metrics_interval));
+    }
+}
+
+/*****************************************************************************/
+uint64_t T_filesystem_load::get_unsigned_arg(const string& arg_name,
+                                             uint64_t min_value,
+                                             uint64_t max_value,
+                                             uint64_t default_value)
+{
+  uint64_t value = default_value;
+  if (_configuration.has_arg(arg_name))
+    {
+      string value_str = _configuration.get_string(arg_name);
+      bool valid = true;
+      try
+        {
+          value = parse_unsigned<uint64_t>(value_str);
+        }
+      catch (bad_lexical_cast&)
+        {
+          valid = false;
+        }
+      if (not valid || value < min_value || value > max_value)
+        {
+          _handle.log(N_Event::FATAL, "Filter argument: " + arg_name
+                      + ": '" + value_str + "' invalid value");
+          value = default_value;
+        }
+    }
+  _handle.log(N_Event::INFO, "Filter argument: " + arg_name
+               + " = " + to_string(value));
+  return value;
 }
+
 /*****************************************************************************/
 string remove_trailing_slash(const string& path)
 {
@@ -151,44 +422,77 @@ T_filesystem_load::create_filesystem_config()
   LOG(INFO, 9) << "T_filesystem_load::create_filesystem_config()";
 
   T_filesystem_config_ptr conf;
-  if (_fs_type == N_Uri::NFS)
+  if (_fs_type == N_Uri::NFS || _fs_type == N_Uri::FILE)
     {
-      T_mount_config_ptr mount_conf(new T_mount_config());
+      T_local_config_ptr local_conf;
+      if (_fs_type == N_Uri::NFS)
+        {
+          T_mount_config_ptr mount_conf(new T_mount_config());
+
+          mount_conf->remote_path = _configuration.get_string("root_directory");
+          mount_conf->remote_path = remove_trailing_slash(mount_conf->remote_path);
+          LOG(INFO, 4) << "Remote NFS path = " << mount_conf->remote_path;
+          mount_conf->mount_point = _configuration.get_string("mount_point");
+          mount_conf->mount_point = remove_trailing_slash(mount_conf->mount_point);
+          LOG(INFO, 4) << "NFS Mount point = " << mount_conf->mount_point;
+          if (_configuration.has_arg("mount_options"))
+            {
+              mount_conf->mount_options = _configuration.get_string("mount_options");
+            }
+          LOG(INFO, 4) << "NFS Mount options = " << mount_conf->mount_options;
+          mount_conf->root_path = mount_conf->mount_point;
+          local_conf = mount_conf;
+        }
+      else
+        {
+          local_conf.reset(new T_local_config());
+          local_conf->root_path = _configuration.get_string("root_directory");
+          local_conf->root_path = remove_trailing_slash(local_conf->root_path);
+          LOG(INFO, 4) << "Local root path = " << local_conf->root_path;
+        }
 
-      mount_conf->remote_path = _configuration.get_string("root_directory");
-      mount_conf->remote_path = remove_trailing_slash(mount_conf->remote_path);
-      LOG(INFO, 4) << "Remote NFS path = " << mount_conf->remote_path;
-      mount_conf->mount_point = _configuration.get_string("mount_point");
-      mount_conf->mount_point = remove_trailing_slash(mount_conf->mount_point);
-      LOG(INFO, 4) << "NFS Mount point = " << mount_conf->mount_point;
-      if (_configuration.has_arg("mount_options"))
+      if (_configuration.has_arg("io_engine"))
         {
-          mount_conf->mount_options = _configuration.get_string("mount_options");
+          string io_engine_str = _configuration.get_string("io_engine");
+          to_lower(io_engine_str);
+          if (io_engine_str == "io_uring")
+            {
+              local_conf->use_io_uring = true;
+            }
+          else if (io_engine_str != "sync")
+            {
+              _handle.log(N_Event::FATAL, "Filter argument: io_engine: '"
+                          + io_engine_str + "' invalid value");
+            }
         }
-      LOG(INFO, 4) << "NFS Mount options = " << mount_conf->mount_options;
+      LOG(INFO, 4) << "I/O engine = "
+                   << (local_conf->use_io_uring ? "io_uring" : "sync");
+
+      local_conf->io_queue_depth =
+        get_unsigned_arg("io_queue_depth", 1, 4096, local_conf->io_queue_depth);
 
       if (_configuration.has_arg("user_ids_to_names"))
         {
           map<string, string> uids = _configuration.get_string_map("user_ids_to_names");
-          N_Security::fill_uid_gid_mapping(uids, mount_conf->users_mapping);
+          N_Security::fill_uid_gid_mapping(uids, local_conf->users_mapping);
         }
 
       if (_configuration.has_arg("group_ids_to_names"))
         {
           map<string, string> gids = _configuration.get_string_map("group_ids_to_names");
-          N_Security::fill_uid_gid_mapping(gids, mount_conf->groups_mapping);
+          N_Security::fill_uid_gid_mapping(gids, local_conf->groups_mapping);
         }
 
-      LOG(INFO, 4) << "Users mapping : " << mount_conf->users_mapping.size()
+      LOG(INFO, 4) << "Users mapping : " << local_conf->users_mapping.size()
                   << " mapping(s)";
-      LOG(INFO, 4) << makeIteratorLogger(mount_conf->users_mapping.begin(),
-                                        mount_conf->users_mapping.end());
+      LOG(INFO, 4) << makeIteratorLogger(local_conf->users_mapping.begin(),
+                                        local_conf->users_mapping.end());
 
-      LOG(INFO, 4) << "Groups mapping : " << mount_conf->groups_mapping.size()
+      LOG(INFO, 4) << "Groups mapping : " << local_conf->groups_mapping.size()
                   << " mapping(s)";
-      LOG(INFO, 4) << makeIteratorLogger(mount_conf->groups_mapping.begin(),
-                                        mount_conf->groups_mapping.end());
-      conf = mount_conf;
+      LOG(INFO, 4) << makeIteratorLogger(local_conf->groups_mapping.begin(),
+                                        local_conf->groups_mapping.end());
+      conf = local_conf;
     }
   else if (_fs_type == N_Uri::SMB)
     {
@@ -218,6 +522,10 @@ T_filesystem_load::create_filesystem_config()
       smb_conf->share_name = _configuration.get_string("root_directory");
       LOG(INFO, 4) << "Remote SMB share name = " << smb_conf->share_name;
 
+      smb_conf->read_block_size =
+        get_unsigned_arg("smb_read_block_size", 1, numeric_limits<size_t>::max(),
+                         smb_conf->read_block_size);
+
       if (_configuration.has_arg("user_ids_to_names"))
         {
           smb_conf->add_sid_mappings(_configuration.get_string_map("user_ids_to_names"),
@@ -274,31 +582,44 @@ T_filesystem_load::create_filesystem_config()
 void T_filesystem_load::create_filesystem_proxy()
 {
   T_filesystem_config_ptr fs_config = create_filesystem_config();
+  auto_ptr<T_filesystem_proxy> fs_proxy;
   switch(_fs_type)
     {
     case N_Uri::NFS:
-      _fs_proxy.reset(new T_mounted_filesystem(fs_config));
+      fs_proxy.reset(new T_mounted_filesystem(fs_config));
       break;
     case N_Uri::SMB:
-      _fs_proxy.reset(new T_samba_filesystem(fs_config));
+      fs_proxy.reset(new T_samba_filesystem(fs_config));
+      break;
+    case N_Uri::FILE:
+      fs_proxy.reset(new T_local_filesystem(fs_config));
       break;
     default:
       throw E_error("Invalid filesystem type");
     }
+  // All the calls of the filter and its workers are measured
+  _fs_proxy.reset(new T_instrumented_filesystem(fs_config, fs_proxy.release(),
+                                                _metrics));
 }
 
 /*****************************************************************************/
 void T_filesystem_load::create_acl_provider()
 {
+  // Permissions are read through the instrumented proxy, if any
+  T_instrumented_filesystem* instrumented
+    = dynamic_cast<T_instrumented_filesystem*>(_fs_proxy.get());
+  T_filesystem_proxy& fs_proxy = instrumented ? instrumented->target()
+                                              : *_fs_proxy;
   switch(_fs_type)
   {
   case N_Uri::NFS:
-    _acl_provider.reset(new T_mount_acl(
-        dynamic_cast<T_mounted_filesystem&>(*_fs_proxy)));
+  case N_Uri::FILE:
+    _acl_provider.reset(new T_local_acl(
+        dynamic_cast<T_local_filesystem&>(fs_proxy), *_fs_proxy));
     break;
   case N_Uri::SMB:
     _acl_provider.reset(new T_samba_acl(
-        dynamic_cast<T_samba_filesystem&>(*_fs_proxy)));
+        dynamic_cast<T_samba_filesystem&>(fs_proxy), *_fs_proxy));
     break;
   default:
     throw E_error("Invalid filesystem type");
@@ -318,9 +639,19 @@ void T_filesystem_load::process(AFS::PaF::Document& doc)
     {
     case N_Uri::NFS:
     case N_Uri::SMB:
+    case N_Uri::FILE:
       if (uri.protocol() == _fs_type)
         {
-          process_uri(uri, doc);
+          try
+            {
+              process_uri(uri, doc);
+            }
+          catch(...)
+            {
+              // Changes staged by this run are not written
+              _run_failed = true;
+              throw;
+            }
         }
       else
         {
@@ -335,34 +666,137 @@ void T_filesystem_load::process(AFS::PaF::Document& doc)
       doc.set_status(N_PaF::OK);
     }
 
-  process_deleted_files();
-
   // If I am here, all is OK
   LOG(INFO, 9) << "End of process !";
 }
 
+/*****************************************************************************/
+void
+T_filesystem_load::end_of_run()
+{
+  // Deletion detection runs once for all the roots crawled during the run
+  if (_crawled_roots.empty())
+    {
+      return;
+    }
+
+  if (_run_failed)
+    {
+      _handle.log(N_Event::WARNING, "Deleted files are not processed: some"
+                  " input documents could not be crawled");
+    }
+  else
+    {
+      if (_stats._nb_failed_directories > 0)
+        {
+          // Files of an unlisted directory would be probed, and found
+          // missing if the filesystem is unavailable
+          _handle.log(N_Event::WARNING, "Deleted files are not processed: "
+                      + N_String::to_string(_stats._nb_failed_directories)
+                      + " director(ies) could not be crawled");
+        }
+      else
+        {
+          try
+            {
+              process_deleted_files();
+            }
+          catch(E_error& e)
+            {
+              _handle.log(N_Event::ERROR, "Could not process deleted files ["
+                                          + string(e.what()) + "]");
+            }
+          catch(...)
+            {
+              _handle.log(N_Event::ERROR, "Could not process deleted files");
+            }
+        }
+
+      if (_state_index.get())
+        {
+          try
+            {
+              _state_index->commit();
+            }
+          catch(E_error& e)
+            {
+              _handle.log(N_Event::ERROR, "Could not update crawl state index ["
+                                          + string(e.what()) + "]");
+            }
+        }
+    }
+
+  if (_listing_cache.get())
+    {
+      try
+        {
+          _manifest.freeze();
+          _listing_cache->save(_manifest, _crawled_root_paths);
+        }
+      catch(E_error& e)
+        {
+          _handle.log(N_Event::ERROR, "Could not save listing cache ["
+                                      + string(e.what()) + "]");
+        }
+    }
+  _crawled_roots.clear();
+  _crawled_root_paths.clear();
+}
+
+/*****************************************************************************/
+bool
+T_filesystem_load::is_under_crawled_root(const string& doc_uri) const
+{
+  // Look up the URI and each of its ancestors
+  for (string::size_type length = doc_uri.size();
+       length != 0 && length != string::npos;
+       length = doc_uri.rfind('/', length - 1))
+    {
+      if (_crawled_roots.count(doc_uri.substr(0, length)) != 0
+          || _crawled_roots.count(doc_uri.substr(0, length + 1)) != 0)
+        {
+          return true;
+        }
+    }
+  return false;
+}
+
 /*****************************************************************************/
 void
 T_filesystem_load::process_deleted_files()
 {
+  _manifest.freeze();
+  _handle.log(N_Event::INFO, "Crawl manifest: "
+              + N_String::to_string(_manifest.size()) + " entries listed");
+
   // Get candidates for deletion
   string paf_id_str = N_String::to_string(
       AFS::PaF::Pipe::pipe().get_current_PaF_id());
+  T_timed_operation get_where_timer(_metrics[T_filesystem_metrics::GET_WHERE]);
   auto_ptr<AFS::PaF::DocumentQueue> docs
     = _handle.get_where(
         "protocol = " + N_Uri::Protocol_Name(_fs_type)
         +" and status != DELETED and PaFId < "+paf_id_str);
+  get_where_timer.done(0, docs->size());
 
   _handle.log(N_Event::INFO, "Will inspect " + N_String::to_string(docs->size())
-              + " documents for suppression");
+              + " documents for suppression ("
+              + N_String::to_string(_crawled_roots.size())
+              + " root(s) crawled)");
 
   // Check if candidates were deleted and add to a set if yes
   set<string> uris_to_delete;
+  size_t nb_out_of_roots = 0;
   while (not docs->empty())
     {
       auto_ptr<AFS::PaF::Document> doc = docs->pop();
       string doc_uri = doc->get_uri();
-      if (doc->get_status() == N_PaF::EOL)
+      if (not is_under_crawled_root(doc_uri))
+        {
+          // Loaded from other roots, maybe by other runs
+          ++nb_out_of_roots;
+        }
+      else if (doc->get_status() == N_PaF::EOL)
         {
           if (to_be_deleted(*get_document_url(*doc)))
             {
@@ -380,12 +814,24 @@ T_filesystem_load::process_deleted_files()
     }
   _handle.log(N_Event::INFO, "Documents suppression inspection finished, "
                 + N_String::to_string(uris_to_delete.size())
-                + " document(s) must be deleted.");
+                + " document(s) must be deleted, "
+                + N_String::to_string(nb_out_of_roots)
+                + " out of the crawled roots.");
 
   if (uris_to_delete.size() != 0)
     {
+      T_timed_operation delete_timer(_metrics[T_filesystem_metrics::DELETE_DOCUMENTS]);
       _handle.delete_documents(uris_to_delete);
+      delete_timer.done(0, uris_to_delete.size());
       _stats._nb_deleted_files = uris_to_delete.size();
+      if (_state_index.get())
+        {
+          // Reload these files if they come back or are no longer filtered
+          BOOST_FOREACH(const string& doc_uri, uris_to_delete)
+            {
+              _state_index->remove(doc_uri);
+            }
+        }
     }
 
   _handle.log(N_Event::INFO, "Documents suppression completed.");
@@ -395,12 +841,23 @@ T_filesystem_load::process_deleted_files()
 bool
 T_filesystem_load::to_be_deleted(const T_url& url)
 {
-  bool filtered = not _path_filter->accept(url.get_local_path());
-  bool existing = _fs_proxy->check_if_file_exists(url);
-  LOG(INFO, 5) << "Check before delete: " << url.get_local_path()
+  string local_path = url.get_local_path();
+  bool filtered = not _path_filter->accept(local_path);
+  if (filtered)
+    {
+      LOG(INFO, 5) << "Check before delete: " << local_path
+                   << " : filtered = " << filtered;
+      return true;
+    }
+
+  bool in_scope = _manifest.is_in_scope(local_path);
+  bool existing = in_scope ? _manifest.contains(local_path)
+                           : _fs_proxy->check_if_file_exists(url);
+  LOG(INFO, 5) << "Check before delete: " << local_path
                << " : filtered = " << filtered
+               << " / in scope = " << in_scope
                << " / existing = " << existing;
-  return (filtered || not existing);
+  return not existing;
 }
 
 /*****************************************************************************/
@@ -411,28 +868,64 @@ T_filesystem_load::process_uri(N_Uri::T_uri& uri,
   _handle.log(N_Event::INFO,
               "RECEIVED URI to load: " + uri.get_raw_uri());
   T_url_ptr url = _fs_proxy->create_url(uri);
+  _crawled_roots.insert(get_document_uri(*url));
+  _crawled_root_paths.insert(url->get_local_path());
 
   // Check if URI is a directory or a file
-  if (_fs_proxy->check_if_dir_exists(*url))
+  T_file_info info;
+  try
     {
-      process_directory(*url, doc);
+      _fs_proxy->read_file_info(*url, info);
+    }
+  catch(E_error& e)
+    {
+      // Processed as a file: error is reported when loading it
+      LOG(INFO, 5) << "Could not read metadata of " << uri.get_raw_uri()
+                   << " [" << e.what() << "]";
+    }
+
+  if (info.type == T_file_info::DIRECTORY)
+    {
+      process_directory(*url, info, doc);
     }
   else
     {
-      process_file(*url, doc);
+      process_file(*url, info, doc);
     }
 }
 
 /*****************************************************************************/
-void 
+bool
 T_filesystem_load::process_file(const T_url& file_url,
-                                AFS::PaF::Document& doc)
+                                T_file_info& info,
+                                AFS::PaF::Document& doc,
+                                T_file_read* file_read)
 {
-  string file_local_path = file_url.get_local_path();
-  _handle.log(N_Event::INFO, "LOADING file: " + file_local_path);
+  const string& file_local_path = file_url.get_local_path();
+  log_info("LOADING file: " + file_local_path);
 
   try
     {
+      if (not info.has_attributes)
+        {
+          _fs_proxy->read_file_info(file_url, info);
+        }
+
+      if (_max_file_size != 0 && info.size > _max_file_size)
+        {
+          if (_oversized_files == SKIP_OVERSIZED)
+            {
+              log_info("Skipping oversized file: " + file_local_path);
+              return false;
+            }
+          if (_oversized_files == KO_OVERSIZED)
+            {
+              log_error("Could not load file: " + file_local_path
+                        + " [file larger than max_file_size]");
+              return true;
+            }
+        }
+
       if (!doc.has_layer(N_PaF::N_Layer::CONTENTS))
         {
           ++_stats._nb_new_files;
@@ -442,56 +935,145 @@ T_filesystem_load::process_file(const T_url& file_url,
           ++_stats._nb_updated_files;
         }
 
-      add_contents_layer(file_url, doc);
+      add_contents_layer(file_url, info, doc, file_read);
       if (AFS::PaF::Pipe::pipe().is_secured())
         {
-          add_acl_layer(file_url, doc);
+          add_acl_layer(file_url, info, doc);
           add_sar_layer(file_url, doc);
         }
       doc.set_status(N_PaF::OK);
     }
   catch(E_error& e)
     {
-      _handle.log(N_Event::ERROR, "Could not load file: "
-                                  + file_url.get_local_path()
-                                  + " [" + e.what() + "]");
+      log_error("Could not load file: " + file_url.get_local_path()
+                + " [" + e.what() + "]");
     }
   catch(...)
     {
-      _handle.log(N_Event::ERROR, "Could not load file: "
-                                  + file_url.get_local_path());
+      log_error("Could not load file: " + file_url.get_local_path());
+    }
+  return true;
+}
+
+/*****************************************************************************/
+bool
+T_filesystem_load::is_file_unchanged(const T_url& file_url,
+                                     const string& doc_uri,
+                                     T_file_info& info)
+{
+  if (not _state_index.get() || AFS::PaF::Pipe::pipe().is_secured())
+    {
+      return false;
     }
+  if (not info.has_attributes)
+    {
+      try
+        {
+          _fs_proxy->read_file_info(file_url, info);
+        }
+      catch(E_error&)
+        {
+          // Error is reported when loading the file
+          return false;
+        }
+    }
+  return _state_index->is_unchanged(doc_uri, info);
 }
 
 /*****************************************************************************/
 void
 T_filesystem_load::add_contents_layer(const T_url& url, 
-                               AFS::PaF::Document& doc)
+                               const T_file_info& info,
+                               AFS::PaF::Document& doc,
+                               T_file_read* file_read)
 {
   if ((!doc.has_layer(N_PaF::N_Layer::CONTENTS)
       || is_layer_obsolete(N_PaF::N_Layer::CONTENTS,
                            doc,
-                           _fs_proxy->read_file_mtime(url))))
+                           info.mtime)))
   {
-    T_binary_string data;
-    _fs_proxy->read_file_content(url, data);
-    doc.set_layer(data.get_data(), _output_type);
+    // Layer is older than the file, but a previous run found the same
+    // content at this mtime: the file is not read again
+    uint64_t previous_digest;
+    time_t digest_mtime;
+    if (_state_index.get()
+        && doc.has_layer(N_PaF::N_Layer::CONTENTS)
+        && _state_index->get_digest(doc.get_uri(), previous_digest, digest_mtime)
+        && digest_mtime == info.mtime)
+      {
+        LOG(INFO, 5) << "Unchanged file content: " << url.get_local_path();
+        ++_stats._nb_same_content_files;
+        return;
+      }
+
+    // Content is read in chunks, and never beyond max_file_size
+    uint64_t max_size = get_max_content_size();
+    string data;
+    bool complete;
+    if (file_read != NULL && file_read->content_read)
+      {
+        if (not file_read->error.empty())
+          {
+            throw E_system(file_read->error);
+          }
+        data.swap(file_read->data);
+        complete = file_read->complete;
+      }
+    else
+      {
+        complete = _fs_proxy->read_file_content(url, info, data, max_size);
+      }
+    if (not complete)
+      {
+        // File may have grown since it was listed
+        if (_oversized_files != TRUNCATE_OVERSIZED)
+          {
+            throw E_system("file larger than max_file_size");
+          }
+        LOG(WARNING, 2) << "Truncated file content: " << url.get_local_path()
+                        << " (" << max_size << " bytes loaded)";
+      }
+
+    // Files touched without being modified keep their layer
+    if (_state_index.get())
+      {
+        string doc_uri = doc.get_uri();
+        uint64_t digest = xxhash64(data.data(), data.size());
+        digest = (digest == 0) ? 1 : digest;
+        // The layer keeps its timestamp: the mtime recorded with the digest
+        // avoids reading the file again at the next run
+        _state_index->set_digest(doc_uri, digest, info.mtime);
+        if (doc.has_layer(N_PaF::N_Layer::CONTENTS)
+            && _state_index->get_digest(doc_uri, previous_digest, digest_mtime)
+            && previous_digest == digest)
+          {
+            LOG(INFO, 5) << "Unchanged file content: " << url.get_local_path();
+            ++_stats._nb_same_content_files;
+            return;
+          }
+        doc.set_layer(data, _output_type);
+        return;
+      }
+    doc.set_layer(data, _output_type);
   }
 }
 
 /*****************************************************************************/
 void 
 T_filesystem_load::add_acl_layer(const T_url& url, 
+                                 const T_file_info& info,
                                  AFS::PaF::Document& doc)
 {
   if ((!doc.has_layer(N_PaF::N_Layer::ACL)
       || is_layer_obsolete(N_PaF::N_Layer::ACL, 
                            doc, 
-                           _fs_proxy->read_file_ctime(url))))
+                           info.ctime)))
     {
       try
         {
+          T_timed_operation timer(_metrics[T_filesystem_metrics::ACL]);
           ACL file_acl = (*_acl_provider)(url.get_local_path());
+          timer.done();
           doc.set_protobuf_layer(file_acl, N_PaF::N_Layer::ACL);
         }
       catch (E_system& e)
@@ -514,12 +1096,30 @@ T_filesystem_load::add_acl_layer(const T_url& url,
 void
 T_filesystem_load::add_sar_layer(const T_url& url, AFS::PaF::Document& doc)
 {
-  // SAR layer is always (re)computed as it depends on other documents ACLs
-  LOG(INFO, 6) << "Compute SAR for " << doc.get_uri();
+  // SAR depends on other documents ACLs: it is shared by the files with the
+  // same ACLs, and kept while these ACLs do not change
   try
     {
-      SAR sar = _acl_provider->compute_sar_layer(url);
-      doc.set_protobuf_layer(sar, N_PaF::N_Layer::SAR);
+      string sar_bytes;
+      T_timed_operation timer(_metrics[T_filesystem_metrics::SAR]);
+      uint64_t sar_key = _acl_provider->get_sar_layer(url, sar_bytes);
+      timer.done(sar_bytes.size());
+      string doc_uri = doc.get_uri();
+      uint64_t previous_sar_key;
+      if (_state_index.get()
+          && doc.has_layer(N_PaF::N_Layer::SAR)
+          && _state_index->get_sar_key(doc_uri, previous_sar_key)
+          && previous_sar_key == sar_key)
+        {
+          LOG(INFO, 6) << "Unchanged SAR for " << doc_uri;
+          return;
+        }
+      doc.set_layer(sar_bytes, N_PaF::N_Layer::SAR);
+      if (_state_index.get())
+        {
+          // Written with the document, dropped if it is not sent
+          _state_index->set_sar_key(doc_uri, sar_key);
+        }
     }
   catch (E_system& e)
     {
@@ -530,6 +1130,14 @@ T_filesystem_load::add_sar_layer(const T_url& url, AFS::PaF::Document& doc)
     }
 }
 
+/*****************************************************************************/
+uint64_t
+T_filesystem_load::get_max_content_size() const
+{
+  return (_max_file_size != 0) ? _max_file_size
+                               : numeric_limits<uint64_t>::max();
+}
+
 /*****************************************************************************/
 bool 
 T_filesystem_load::is_layer_obsolete(N_PaF::N_Layer::Type type, 
@@ -542,14 +1150,62 @@ T_filesystem_load::is_layer_obsolete(N_PaF::N_Layer::Type type,
 
 /*****************************************************************************/
 void T_filesystem_load::process_directory(const T_url& dir_url,
+                                          T_file_info& info,
                                           AFS::PaF::Document& doc)
 {
-  set<string>   files;
-  set<string>   subdirectories;
+  vector<T_url_ptr> subdirectories;
+  load_directory(dir_url, info, doc, subdirectories);
+  if (AFS::PaF::Pipe::pipe().is_secured())
+    {
+      _acl_provider->directory_done(dir_url.get_local_path(),
+                                    subdirectories.size());
+    }
 
-  _handle.log(N_Event::INFO,
-              "Start processing directory: " + dir_url.get_local_path(),
-              N_Event::VERBOSE);
+  T_crawler crawler(*this, _crawl_threads, _crawl_order, _crawl_max_frontier);
+  crawler.run(subdirectories);
+}
+
+/*****************************************************************************/
+void T_filesystem_load::visit_directory(const T_url& dir_url,
+                                        vector<T_url_ptr>& subdirectories)
+{
+  auto_ptr< AFS::PaF::Document> doc;
+  try
+    {
+      doc = get_or_create_document(dir_url);
+    }
+  catch(...)
+    {
+      // Directory is not listed: reported by the crawler
+      ++_stats._nb_failed_directories;
+      if (AFS::PaF::Pipe::pipe().is_secured())
+        {
+          // No subdirectory is visited: ancestors ACLs can be released
+          _acl_provider->directory_done(dir_url.get_local_path(), 0);
+        }
+      throw;
+    }
+  T_file_info info(T_file_info::DIRECTORY);
+  load_directory(dir_url, info, *doc, subdirectories);
+  if (AFS::PaF::Pipe::pipe().is_secured())
+    {
+      // Subdirectories are visited next: their ancestors ACLs are kept
+      _acl_provider->directory_done(dir_url.get_local_path(),
+                                    subdirectories.size());
+    }
+  // Send document to next filter
+  send_document(doc);
+}
+
+/*****************************************************************************/
+void T_filesystem_load::load_directory(const T_url& dir_url,
+                                       T_file_info& info,
+                                       AFS::PaF::Document& doc,
+                                       vector<T_url_ptr>& subdirectories)
+{
+  T_directory_entries entries;
+
+  log_info("Start processing directory: " + dir_url.get_local_path(), true);
   ++_stats._nb_directories;
 
   // Add trailing slash if missing
@@ -563,64 +1219,89 @@ void T_filesystem_load::process_directory(const T_url& dir_url,
     {
       if (AFS::PaF::Pipe::pipe().is_secured())
         {
-          add_acl_layer(dir_url, doc);
+          // Directory attributes are only needed for its permissions
+          if (not info.has_attributes)
+            {
+              _fs_proxy->read_file_info(dir_url, info);
+            }
+          add_acl_layer(dir_url, info, doc);
         }
 
-      _fs_proxy->get_directory_files(dir_url, files);
-      _fs_proxy->get_directory_subdirectories(dir_url, subdirectories);
+      // Nothing to load under this directory
+      if (_path_filter->is_subtree_excluded(dir_path_s))
+        {
+          log_info("Skipping directory content, excluded by filters: "
+                   + dir_url.get_local_path(), true);
+          doc.set_status(N_PaF::AUX);
+          return;
+        }
+
+      list_directory(dir_url, info, entries);
 
-      BOOST_FOREACH(string file_local_path, files)
+      // Keep track of listed entries for deletion detection
+      _manifest.add_listing(dir_url.get_local_path(), entries);
+
+      // Entry paths are built in place after the directory path
+      const size_t dir_path_length = dir_path_s.size();
+      string entry_path = dir_path_s;
+
+      // Files first, then subdirectories
+      vector<size_t> accepted_files;
+      for (size_t i = 0; i < entries.size(); ++i)
         {
-          if (_path_filter->accept(file_local_path))
+          if (entries.info(i).type != T_file_info::REGULAR_FILE)
             {
-              T_url_ptr file_url = _fs_proxy->create_url(file_local_path);
-              auto_ptr< AFS::PaF::Document> doc = get_or_create_document(*file_url);
-
-              try
-                {
-                  process_file(*file_url, *doc);
-                    // Send document to next filter
-                  _handle.send(doc);
-                }
-              catch (E_system& e)
-                {
-                  if (_skip_non_readable_files)
-                    {
-                      LOG(WARNING, 2) << "Non readable file: " << file_local_path
-                                      << "(" << e << ")"
-                                      << " - skipped";
-                    }
-                  else
-                    {
-                      LOG(WARNING, 2) << "Non readable file: " << file_local_path
-                                      << "(" << e << ")"
-                                      << " - document KO";
-                      _handle.send(doc);
-                    }
-                }
+              continue;
+            }
+          entry_path.resize(dir_path_length);
+          entry_path.append(entries.name_data(i), entries.name_length(i));
+          if (_path_filter->accept(entry_path))
+            {
+              accepted_files.push_back(i);
             }
           else
             {
-              _handle.log(N_Event::INFO,
-                          "Skipping ignored file: " + file_local_path,
-                          N_Event::VERBOSE);
+              log_info("Skipping ignored file: " + entry_path, true);
             }
         }
-      BOOST_FOREACH(string subdir_local_path, subdirectories)
+
+      // Attributes of all the files at once, when the filesystem batches them
+      _fs_proxy->read_entries_info(dir_url, entries, accepted_files);
+
+      vector<T_file_to_load> files;
+      for (size_t j = 0; j < accepted_files.size(); ++j)
         {
-          if (_path_filter->accept(subdir_local_path))
+          size_t i = accepted_files[j];
+          entry_path.resize(dir_path_length);
+          entry_path.append(entries.name_data(i), entries.name_length(i));
+          T_url_ptr file_url = _fs_proxy->create_entry_url(dir_url, entry_path);
+          string doc_uri = get_document_uri(*file_url);
+          T_file_info file_info = entries.info(i);
+          if (is_file_unchanged(*file_url, doc_uri, file_info))
             {
-              T_url_ptr subdir_url = _fs_proxy->create_url(subdir_local_path);
-              auto_ptr< AFS::PaF::Document> doc = get_or_create_document(*subdir_url);
-              process_directory(*subdir_url, *doc);
-              // Send document to next filter
-              _handle.send(doc);
+              log_info("Skipping unchanged file: " + entry_path, true);
+              ++_stats._nb_unchanged_files;
+              continue;
+            }
+          files.push_back(T_file_to_load(file_url, doc_uri, file_info));
+        }
+      load_files(files);
+      for (size_t i = 0; i < entries.size(); ++i)
+        {
+          if (entries.info(i).type != T_file_info::DIRECTORY)
+            {
+              continue;
+            }
+          entry_path.resize(dir_path_length);
+          entry_path.append(entries.name_data(i), entries.name_length(i));
+          if (_path_filter->accept(entry_path))
+            {
+              subdirectories.push_back(_fs_proxy->create_entry_url(dir_url,
+                                                                   entry_path));
             }
           else
             {
-              _handle.log(N_Event::INFO,
-                          "Skipping ignored directory: " + subdir_local_path,
-                          N_Event::VERBOSE);
+              log_info("Skipping ignored directory: " + entry_path, true);
             }
         }
 
@@ -628,27 +1309,210 @@ void T_filesystem_load::process_directory(const T_url& dir_url,
     }
   catch(E_error& e)
       {
-      _handle.log(N_Event::ERROR, "Could not load directory: "
-                                  + dir_url.get_local_path()
-                                  + " [" + e.what() + "]");
+      log_error("Could not load directory: " + dir_url.get_local_path()
+                + " [" + e.what() + "]");
+      ++_stats._nb_failed_directories;
       doc.set_status(N_PaF::KO);
+      subdirectories.clear();
     }
   catch(...)
     {
-      _handle.log(N_Event::ERROR, "Could not load directory: "
-                                  + dir_url.get_local_path());
+      log_error("Could not load directory: " + dir_url.get_local_path());
+      ++_stats._nb_failed_directories;
       doc.set_status(N_PaF::KO);
+      subdirectories.clear();
     }
 
   LOG(INFO, 6) << "End processing directory: " << dir_path_s;
 }
 
+/*****************************************************************************/
+void T_filesystem_load::list_directory(const T_url& dir_url,
+                                       T_file_info& info,
+                                       T_directory_entries& entries)
+{
+  if (not _listing_cache.get())
+    {
+      _fs_proxy->list_directory(dir_url, entries);
+      return;
+    }
+
+  if (not info.has_attributes)
+    {
+      _fs_proxy->read_file_info(dir_url, info);
+    }
+  const string& dir_path = dir_url.get_local_path();
+  if (_listing_cache->get(dir_path, info.mtime, entries))
+    {
+      LOG(INFO, 6) << "Reusing listing of unchanged directory: " << dir_path;
+      ++_stats._nb_cached_listings;
+      return;
+    }
+
+  time_t listing_time = time(NULL);
+  _fs_proxy->list_directory(dir_url, entries);
+  _listing_cache->put(dir_path, info.mtime, listing_time, entries);
+}
+
+/*****************************************************************************/
+void T_filesystem_load::load_files(vector<T_file_to_load>& files)
+{
+  // Documents are fetched from PaF by batches
+  size_t batch_size = (_prefetch_batch_size > 0) ? _prefetch_batch_size : 1;
+  for (size_t begin = 0; begin < files.size(); begin += batch_size)
+    {
+      size_t end = std::min(begin + batch_size, files.size());
+      vector<string> doc_uris;
+      for (size_t i = begin; i < end; ++i)
+        {
+          doc_uris.push_back(files[i].doc_uri);
+        }
+      T_document_map docs;
+      get_or_create_documents(doc_uris, docs);
+
+      // Next files are read while the current document is processed and sent
+      T_read_ahead* read_ahead = NULL;
+      if (_read_ahead_depth > 0 && end - begin > 1)
+        {
+          read_ahead = &get_read_ahead();
+        }
+
+      try
+        {
+          if (read_ahead != NULL)
+            {
+              for (size_t i = begin; i < end; ++i)
+                {
+                  AFS::PaF::Document& doc = docs.at(files[i].doc_uri);
+                  time_t last_load = numeric_limits<time_t>::min();
+                  if (doc.has_layer(N_PaF::N_Layer::CONTENTS))
+                    {
+                      last_load = doc.get_layer(N_PaF::N_Layer::CONTENTS)
+                                    ->get_last_modified().get_timestamp();
+                      uint64_t digest;
+                      time_t digest_mtime;
+                      if (_state_index.get()
+                          && _state_index->get_digest(files[i].doc_uri, digest,
+                                                      digest_mtime))
+                        {
+                          // Content found unchanged at this mtime
+                          last_load = std::max(last_load, digest_mtime);
+                        }
+                    }
+                  read_ahead->add(files[i].url, files[i].info, last_load);
+                }
+              read_ahead->start();
+            }
+
+          for (size_t i = begin; i < end; ++i)
+            {
+              T_document_map::iterator it = docs.find(files[i].doc_uri);
+              assert(it != docs.end());
+              auto_ptr< AFS::PaF::Document> doc(docs.release(it).release());
+              T_file_read* file_read = NULL;
+              if (read_ahead != NULL)
+                {
+                  file_read = &read_ahead->wait(i - begin);
+                  if (file_read->info.has_attributes)
+                    {
+                      files[i].info = file_read->info;
+                    }
+                }
+              load_file(files[i], doc, file_read);
+            }
+        }
+      catch(...)
+        {
+          if (read_ahead != NULL)
+            {
+              read_ahead->clear();
+            }
+          throw;
+        }
+      if (read_ahead != NULL)
+        {
+          read_ahead->clear();
+        }
+    }
+}
+
+/*****************************************************************************/
+T_read_ahead& T_filesystem_load::get_read_ahead()
+{
+  T_read_ahead* read_ahead = _read_ahead.get();
+  if (read_ahead == NULL)
+    {
+      read_ahead = new T_read_ahead(*_fs_proxy,
+                                    _read_ahead_depth,
+                                    _read_ahead_bytes,
+                                    get_max_content_size(),
+                                    _max_file_size == 0
+                                    || _oversized_files == TRUNCATE_OVERSIZED);
+      _read_ahead.reset(read_ahead);
+    }
+  return *read_ahead;
+}
+
+/*****************************************************************************/
+void T_filesystem_load::load_file(T_file_to_load& file,
+                                  auto_ptr< AFS::PaF::Document>& doc,
+                                  T_file_read* file_read)
+{
+  const T_url& file_url = *file.url;
+  bool sent = false;
+  try
+    {
+      if (process_file(file_url, file.info, *doc, file_read))
+        {
+          T_crawl_state_index::Outcome outcome = (doc->get_status() == N_PaF::OK)
+            ? T_crawl_state_index::LOADED_OK
+            : T_crawl_state_index::LOADED_KO;
+          // Send document to next filter
+          send_document(doc);
+          sent = true;
+          if (_state_index.get() && file.info.has_attributes)
+            {
+              _state_index->update(file.doc_uri, file.info, outcome);
+            }
+        }
+    }
+  catch (E_system& e)
+    {
+      if (_skip_non_readable_files)
+        {
+          LOG(WARNING, 2) << "Non readable file: " << file_url.get_local_path()
+                          << "(" << e << ")"
+                          << " - skipped";
+        }
+      else
+        {
+          LOG(WARNING, 2) << "Non readable file: " << file_url.get_local_path()
+                          << "(" << e << ")"
+                          << " - document KO";
+          send_document(doc);
+        }
+    }
+  catch (...)
+    {
+      if (_state_index.get())
+        {
+          _state_index->discard(file.doc_uri);
+        }
+      throw;
+    }
+  if (not sent && _state_index.get())
+    {
+      // Layer keys staged while processing the file are not kept
+      _state_index->discard(file.doc_uri);
+    }
+}
+
 /*****************************************************************************/
 string 
 T_filesystem_load::get_document_uri(const T_url& url)
 {
   // PaF NFS document URI is the raw uri: "nfs://10.0.0.1/remote/full/path"
-  return url.get_uri().get_raw_uri(true, false);
+  return url.get_document_uri();
 }
 
 /*****************************************************************************/
@@ -664,7 +1528,10 @@ T_filesystem_load::get_or_create_document(const T_url& url)
 {
   string doc_uri = get_document_uri(url);
   
+  mutex::scoped_lock lock(_handle_mutex);
+  T_timed_operation timer(_metrics[T_filesystem_metrics::GET_DOCUMENT]);
   auto_ptr<AFS::PaF::Document > doc = _handle.get_document(doc_uri);
+  timer.done();
   if (doc.get() == NULL)
     {
       LOG(INFO, 6) << "Creating new document: " << doc_uri;
@@ -678,91 +1545,150 @@ T_filesystem_load::get_or_create_document(const T_url& url)
   return doc;
 }
 
-
 /*****************************************************************************/
-T_path_filter::T_path_filter(bool case_sensitive)
-  : _is_case_sensitive(case_sensitive)
-{
-}
-
 void
-T_path_filter::set_excluded_patterns(const std::list< string >& patterns)
+T_filesystem_load::get_or_create_documents(const vector<string>& doc_uris,
+                                           T_document_map& docs)
 {
-  _excludes = patterns;
-  if (not _is_case_sensitive)
+  mutex::scoped_lock lock(_handle_mutex);
+  bool queried = false;
+  if (_prefetch_batch_size > 1 && not _prefetch_disabled && doc_uris.size() > 1)
     {
-      lowercase(_excludes);
+      // One query for the whole batch instead of one lookup per document.
+      // Only a hint until verified: documents it does not return are looked
+      // up one by one
+      ostringstream query;
+      query << "uri in (";
+      for (size_t i = 0; i < doc_uris.size(); ++i)
+        {
+          query << ((i > 0) ? ", " : "") << quote_query_value(doc_uris[i]);
+        }
+      query << ")";
+      try
+        {
+          T_timed_operation timer(_metrics[T_filesystem_metrics::GET_WHERE]);
+          auto_ptr<AFS::PaF::DocumentQueue> found = _handle.get_where(query.str());
+          timer.done(0, found->size());
+          set<string> requested(doc_uris.begin(), doc_uris.end());
+          while (not found->empty())
+            {
+              auto_ptr<AFS::PaF::Document> doc = found->pop();
+              string doc_uri = doc->get_uri();
+              if (requested.count(doc_uri) == 0)
+                {
+                  throw E_error("query returned an unexpected document: "
+                                + doc_uri);
+                }
+              docs.insert(doc_uri, doc);
+            }
+          queried = true;
+        }
+      catch(E_error& e)
+        {
+          _prefetch_disabled = true;
+          docs.clear();
+          _handle.log(N_Event::WARNING, "Document prefetch disabled, documents are read"
+                      " one by one [" + string(e.what()) + "]");
+        }
     }
-  LOG(INFO, 7) << "Excluded patterns: "
-               << makeIteratorLogger(_excludes.begin(), _excludes.end());
-}
 
-void
-T_path_filter::set_included_patterns(const std::list< string >& patterns)
-{
-  _includes = patterns;
-  if (not _is_case_sensitive)
+  LOG(INFO, 6) << "Found " << docs.size() << " existing document(s) out of "
+               << doc_uris.size();
+  const bool verify = queried && not _prefetch_verified;
+  const bool found_some = not docs.empty();
+  size_t nb_missed = 0; // existing documents the query did not return
+  BOOST_FOREACH(string doc_uri, doc_uris)
     {
-      lowercase(_includes);
+      T_document_map::iterator it = docs.find(doc_uri);
+      if (it == docs.end())
+        {
+          auto_ptr<AFS::PaF::Document> doc;
+          if (not queried || verify)
+            {
+              T_timed_operation timer(_metrics[T_filesystem_metrics::GET_DOCUMENT]);
+              doc = _handle.get_document(doc_uri);
+              timer.done();
+            }
+          if (doc.get() == NULL)
+            {
+              LOG(INFO, 6) << "Creating new document: " << doc_uri;
+              doc = _handle.new_document(doc_uri);
+            }
+          else if (queried)
+            {
+              ++nb_missed;
+            }
+          it = docs.insert(doc_uri, doc).first;
+        }
+      it->second->set_status(N_PaF::KO);
     }
-  LOG(INFO, 7) << "Included patterns: "
-               << makeIteratorLogger(_includes.begin(), _includes.end());
-}
 
-bool
-T_path_filter::accept(const string& path)
-{
-  LOG(INFO, 7) << "Checking path filter for: " << path;
-  return (not is_excluded(path)
-          && ( (_includes.size() == 0) || is_included(path)));
-}
-
-void
-T_path_filter::lowercase(list< string >& patterns)
-{
-  BOOST_FOREACH(string& pattern, patterns)
+  if (nb_missed != 0)
     {
-      boost::to_lower(pattern);
+      // Query is not understood as expected: lookups would be made twice
+      _prefetch_disabled = true;
+      _handle.log(N_Event::WARNING, "Document prefetch disabled, documents are read"
+                  " one by one [" + N_String::to_string(nb_missed)
+                  + " existing document(s) not returned by the batch query]");
+    }
+  else if (verify && found_some)
+    {
+      // Query returned existing documents and only them: the documents it
+      // does not return are new from now on
+      _prefetch_verified = true;
+      LOG(INFO, 4) << "Batch query verified, missing documents are created"
+                   << " without lookup";
     }
 }
 
-bool
-T_path_filter::is_excluded(const string& path)
+/*****************************************************************************/
+string
+T_filesystem_load::quote_query_value(const string& value)
 {
-  return is_matching_one_pattern(path, _excludes);
+  string quoted("\"");
+  BOOST_FOREACH(char c, value)
+    {
+      if (c == '"' || c == '\\')
+        {
+          quoted += '\\';
+        }
+      quoted += c;
+    }
+  quoted += '"';
+  return quoted;
 }
 
-bool
-T_path_filter::is_included(const string& path)
+/*****************************************************************************/
+void
+T_filesystem_load::send_document(auto_ptr< AFS::PaF::Document >& doc)
 {
-  return is_matching_one_pattern(path, _includes);
+  mutex::scoped_lock lock(_handle_mutex);
+  T_timed_operation timer(_metrics[T_filesystem_metrics::SEND]);
+  _handle.send(doc);
+  timer.done();
 }
 
-bool
-T_path_filter::is_matching_one_pattern(const string& path,
-                                       const list< string >& patterns)
+/*****************************************************************************/
+void
+T_filesystem_load::log_info(const string& msg, bool verbose)
 {
-  if (patterns.empty()) return false;
-  string path_to_compare(path);
-  if (not _is_case_sensitive)
+  mutex::scoped_lock lock(_handle_mutex);
+  if (verbose)
     {
-      boost::to_lower(path_to_compare);
+      _handle.log(N_Event::INFO, msg, N_Event::VERBOSE);
     }
-  list<string>::const_iterator it = patterns.begin();
-  while (it != patterns.end())
+  else
     {
-      if (fnmatch(it->c_str(), path_to_compare.c_str(), 0) == 0)
-        {
-          LOG(INFO, 7) << "Path matched pattern: " << *it;
-          return true;
-        }
-      else
-        {
-          LOG(INFO, 7) << "Path did not match pattern: " << *it;
-        }
-      ++it;
+      _handle.log(N_Event::INFO, msg);
     }
-  return false;
+}
+
+/*****************************************************************************/
+void
+T_filesystem_load::log_error(const string& msg)
+{
+  mutex::scoped_lock lock(_handle_mutex);
+  _handle.log(N_Event::ERROR, msg);
 }
 
 
@@ -28,6 +28,12 @@ https://github.com/antidot/AIF-Filters/
 
 #include "fs_url.h"
 #include "fs_proxy.h"
+#include "fs_crawler.h"
+#include "fs_manifest.h"
+#include "fs_state.h"
+#include "fs_listing.h"
+#include "fs_readahead.h"
+#include "fs_metrics.h"
 
 #include <PaF/API/filter.h>
 #include <COMMON/IO/io.h>
@@ -35,20 +41,31 @@ https://github.com/antidot/AIF-Filters/
 
 #include <boost/ptr_container/ptr_container.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/atomic.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
 
 class T_path_filter;
 
 /*****************************************************************************/
 
+//! @brief Filter counters, updated concurrently by crawl workers
 struct T_filesystem_load_stats {
-  uint32_t  _nb_directories;
-  uint32_t  _nb_new_files;
-  uint32_t  _nb_updated_files;
-  uint32_t  _nb_deleted_files;
+  T_filesystem_load_stats();
+
+  boost::atomic<uint32_t>  _nb_directories;
+  boost::atomic<uint32_t>  _nb_new_files;
+  boost::atomic<uint32_t>  _nb_updated_files;
+  boost::atomic<uint32_t>  _nb_unchanged_files;
+  boost::atomic<uint32_t>  _nb_same_content_files;
+  boost::atomic<uint32_t>  _nb_cached_listings;
+  boost::atomic<uint32_t>  _nb_deleted_files;
+  boost::atomic<uint32_t>  _nb_failed_directories; // not listed or not visited
 };
 
 /*****************************************************************************/
-class T_filesystem_load : public AFS::PaF::ProcessorFilter
+class T_filesystem_load : public AFS::PaF::ProcessorFilter,
+                          public T_crawl_visitor
 {
 public:
   T_filesystem_load(AFS::PaF::Configuration& configuration, 
@@ -57,6 +74,10 @@ public:
   virtual ~T_filesystem_load();
   virtual void init();
   virtual void process(AFS::PaF::Document& document);
+
+  //! @brief Process a subdirectory found by the crawler
+  virtual void visit_directory(const T_url& url,
+                               std::vector<T_url_ptr>& subdirectories);
   
 protected:
   boost::scoped_ptr<T_filesystem_proxy> _fs_proxy;
@@ -65,7 +86,51 @@ protected:
   N_PaF::N_Layer::Type              _output_type;
   boost::scoped_ptr<T_filesystem_acl> _acl_provider;
   bool _skip_non_readable_files;
+  uint64_t _max_file_size;    // 0 means no limit
+  enum { SKIP_OVERSIZED, TRUNCATE_OVERSIZED, KO_OVERSIZED } _oversized_files;
+  uint32_t _crawl_threads;
+  T_crawler::Order _crawl_order;
+  uint32_t _crawl_max_frontier; // queued directories, 0 means no limit
+  uint32_t _prefetch_batch_size; // 0 or 1 means one lookup per document
+  boost::atomic<bool> _prefetch_disabled; // set if PaF rejects batch queries
+  bool _prefetch_verified; // batch query returned exactly the existing documents
+  uint32_t _read_ahead_depth;   // files read ahead, 0 means no read-ahead
+  uint64_t _read_ahead_bytes;   // contents held by read-ahead of a worker
+  boost::thread_specific_ptr<T_read_ahead> _read_ahead; // reader of a worker
   T_filesystem_load_stats  _stats;
+  T_filesystem_metrics _metrics;        // filesystem and PaF calls
+  uint32_t _metrics_interval;           // seconds, 0 means only at the end
+  string _metrics_file;                 // optional
+  boost::scoped_ptr<T_metrics_reporter> _metrics_reporter;
+  std::set<std::string> _crawled_roots; // document URIs received in this run
+  std::set<std::string> _crawled_root_paths; // their local paths
+  T_crawl_manifest _manifest;           // listings made in this run
+  boost::scoped_ptr<T_crawl_state_index> _state_index; // optional
+  bool _run_failed; // a root could not be processed
+  boost::scoped_ptr<T_listing_cache> _listing_cache;    // optional
+  boost::mutex _handle_mutex; // PaF handle is shared by crawl workers
+
+  //! @brief A file of a directory, to be loaded
+  struct T_file_to_load
+  {
+    T_file_to_load(T_url_ptr url_, const string& doc_uri_,
+                   const T_file_info& info_)
+      : url(url_), doc_uri(doc_uri_), info(info_) {}
+
+    T_url_ptr   url;
+    string      doc_uri;
+    T_file_info info;
+  };
+
+  typedef boost::ptr_map<string, AFS::PaF::Document> T_document_map;
+
+  //! @brief Read and log an unsigned integer argument
+  //! Values that are not a number or outside [min_value, max_value] are FATAL.
+  //! @return default_value if the argument is not set
+  uint64_t get_unsigned_arg(const string& arg_name,
+                            uint64_t min_value,
+                            uint64_t max_value,
+                            uint64_t default_value);
 
   //! @brief Initializes the configuration of FILESYSTEM
   T_filesystem_config_ptr create_filesystem_config();
@@ -81,15 +146,34 @@ protected:
                    AFS::PaF::Document& doc);
   
   //! @brief Process a file
-  void process_file(const T_url& url,
-                    AFS::PaF::Document& doc);
+  //! @param info file metadata, read if attributes are missing
+  //! @param file_read file read ahead, or NULL
+  //! @return false if the document must not be sent (skipped oversized file)
+  bool process_file(const T_url& url,
+                    T_file_info& info,
+                    AFS::PaF::Document& doc,
+                    T_file_read* file_read = NULL);
   
+  //! @brief Checks in the crawl state index if a file is unchanged since
+  //! it was successfully loaded, without any PaF access
+  //! @param info file metadata, read if attributes are missing
+  bool is_file_unchanged(const T_url& url,
+                         const string& doc_uri,
+                         T_file_info& info);
+
   //! @brief Load file contents into the contents layer of the document
+  //! @param file_read file read ahead, or NULL to read it now
   void add_contents_layer(const T_url& url,
-                          AFS::PaF::Document& doc);
+                          const T_file_info& info,
+                          AFS::PaF::Document& doc,
+                          T_file_read* file_read);
+
+  //! @brief Maximum size of loaded contents
+  uint64_t get_max_content_size() const;
 
   //! @brief Load file/dir permissions into the ACL layer of the document
   void add_acl_layer(const T_url& url,
+                     const T_file_info& info,
                      AFS::PaF::Document& doc);
 
   //! @brief Compute and add SAR layer to document
@@ -102,14 +186,53 @@ protected:
                           AFS::PaF::Document& doc,
                           time_t last_change);
 
-  //! @brief Process a directory
+  //! @brief Process a directory and crawl its whole subtree
   void process_directory(const T_url& url,
+                         T_file_info& info,
                          AFS::PaF::Document& doc);
 
-  //! @brief Processes deleted files
+  //! @brief Load a directory and its files, without recursion
+  //! @param info directory metadata, read if attributes are needed
+  //! @param subdirectories (out) accepted subdirectories
+  void load_directory(const T_url& url,
+                      T_file_info& info,
+                      AFS::PaF::Document& doc,
+                      std::vector<T_url_ptr>& subdirectories);
+
+  //! @brief List a directory, or reuse its cached listing if unchanged
+  //! @param info directory metadata, read if the cache is enabled
+  void list_directory(const T_url& url,
+                      T_file_info& info,
+                      T_directory_entries& entries);
+
+  //! @brief Load the files of a directory, with batched document lookups
+  void load_files(std::vector<T_file_to_load>& files);
+
+  //! @brief Read-ahead of the calling crawl worker, whose reader thread
+  //! is kept for all the directories of the worker
+  T_read_ahead& get_read_ahead();
+
+  //! @brief Load a file and send its document
+  void load_file(T_file_to_load& file,
+                 auto_ptr< AFS::PaF::Document>& doc,
+                 T_file_read* file_read);
+
+  //! @brief End of run: deleted files, crawl state index, listing cache
+  //! The processor API has no end-of-run callback: called by the destructor,
+  //! does nothing if no root was crawled. The index is only written if all
+  //! the roots were processed, and files are only deleted if moreover all
+  //! their directories were listed.
+  void end_of_run();
+
+  //! @brief Processes deleted files under the crawled roots
+  //! Called once at the end of the run, after all input documents
   void process_deleted_files();
 
+  //! @brief Returns true if a document is a crawled root or under one
+  bool is_under_crawled_root(const string& doc_uri) const;
+
   //! @brief Determine if a given file must be deleted or not
+  //! Only files out of the crawled directories are checked on filesystem
   bool to_be_deleted(const T_url& url);
 
   //! @brief Get the PaF document URI from the FILESYSTEM URL
@@ -122,32 +245,33 @@ protected:
   auto_ptr< AFS::PaF::Document > 
   get_or_create_document(const T_url& url);
 
-  //! @brief Log the filter statistics
-  void log_stats();
-};
+  //! @brief Get or create the documents of several URIs (thread-safe)
+  //! Existing documents are fetched by a single PaF query. Until a query
+  //! returned known documents and missed none, the others are looked up one
+  //! by one before being created; then they are created without lookup.
+  //! Prefetch is disabled if the query fails or misses existing documents.
+  //! @param docs (out) a KO document for each URI
+  void get_or_create_documents(const std::vector<string>& doc_uris,
+                               T_document_map& docs);
 
-/*****************************************************************************/
-class T_path_filter
-{
-public:
-  T_path_filter(bool case_sensitive = true);
+  //! @brief Quote a string value for a PaF query
+  static string quote_query_value(const string& value);
 
-  void set_excluded_patterns(const std::list<std::string>& patterns);
-  void set_included_patterns(const std::list<std::string>& patterns);
+  //! @brief Send a document to next filter (thread-safe)
+  void send_document(auto_ptr< AFS::PaF::Document >& doc);
 
-  bool accept(const std::string& path);
+  //! @brief Log an information into PaF logs (thread-safe)
+  void log_info(const string& msg, bool verbose = false);
 
-private:
-  bool _is_case_sensitive;
-  std::list<std::string> _includes;
-  std::list<std::string> _excludes;
+  //! @brief Log an error into PaF logs (thread-safe)
+  void log_error(const string& msg);
+
+  //! @brief Log the filter statistics
+  void log_stats();
 
-private:
-  void lowercase(std::list<std::string>& patterns);
-  bool is_included(const std::string& path);
-  bool is_excluded(const std::string& path);
-  bool is_matching_one_pattern(const std::string& path,
-                               const std::list<std::string>& patterns);
+  //! @brief Log the metrics of the calls so far, and save them if a
+  //! metrics file is set (thread-safe)
+  void report_metrics();
 };
 
 #endif // _FILTER_FILESYSTEM_LOAD_H_
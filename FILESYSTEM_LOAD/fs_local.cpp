@@ -0,0 +1,539 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Local filesystem accessed through directory descriptors
+ *
+ ***************************************************************************/
+
+#include "fs_local.h"
+#include "fs_url.h"
+#include <COMMON/IO/io.h>
+#include <COMMON/BASIC/log.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+
+using namespace N_Security;
+using namespace boost;
+
+namespace {
+  static const size_t read_chunk_size = 1024 * 1024;
+
+  // Part of the descriptors limit used to keep listed directories open
+  static const rlim_t open_directories_ratio = 4;
+  static const uint32_t max_open_directories = 4096;
+
+  // Record returned by getdents64, not exposed by the libc headers
+  struct T_linux_dirent64
+  {
+    uint64_t        d_ino;
+    int64_t         d_off;
+    unsigned short  d_reclen;
+    unsigned char   d_type;
+    char            d_name[1];
+  };
+
+  inline void merge_misses(map<uint32_t, uint32_t>& merged,
+                           const map<uint32_t, uint32_t>& misses)
+  {
+    for (map<uint32_t, uint32_t>::const_iterator it = misses.begin();
+         it != misses.end(); ++it)
+      {
+        merged[it->first] += it->second;
+      }
+  }
+
+  //! @brief Read the files and subdirectories of an open directory
+  void read_entries(int dir_fd,
+                    const string& local_path,
+                    T_directory_entries& entries)
+  {
+    // One getdents64 call returns as many entries as the buffer holds
+    uint64_t buffer[4096];
+    for (;;)
+      {
+        long nb_read = syscall(SYS_getdents64, dir_fd, buffer, sizeof(buffer));
+        if (nb_read < 0)
+          {
+            if (errno == EINTR)
+              {
+                continue;
+              }
+            string errmsg (strerror(errno));
+            throw E_system("Could not list directory: " + local_path + ": " + errmsg);
+          }
+        if (nb_read == 0)
+          {
+            return;
+          }
+
+        const char* data = reinterpret_cast<const char*>(buffer);
+        for (long offset = 0; offset < nb_read; )
+          {
+            const T_linux_dirent64* entry
+              = reinterpret_cast<const T_linux_dirent64*>(data + offset);
+            offset += entry->d_reclen;
+
+            const char* name = entry->d_name;
+            if ((strcmp(name, ".") == 0) || (strcmp(name, "..") == 0))
+              {
+                continue;
+              }
+
+            T_file_info info;
+            unsigned char d_type = entry->d_type;
+            if ((d_type == DT_UNKNOWN) || (d_type == DT_LNK))
+              {
+                // Symbolic links are followed like stat() does
+                struct stat entry_info;
+                if (fstatat(dir_fd, name, &entry_info, 0) < 0)
+                  {
+                    LOG(INFO, 5) << "Could not stat " << local_path << "/" << name
+                                 << ": " << strerror(errno);
+                    continue;
+                  }
+                // Stat was needed anyway: keep all attributes
+                info.set(entry_info);
+                d_type = S_ISDIR(entry_info.st_mode) ? DT_DIR
+                           : (S_ISREG(entry_info.st_mode) ? DT_REG : DT_UNKNOWN);
+              }
+
+            if (d_type == DT_REG)
+              {
+                info.type = T_file_info::REGULAR_FILE;
+                entries.add(name, strlen(name), info);
+              }
+            else if (d_type == DT_DIR)
+              {
+                info.type = T_file_info::DIRECTORY;
+                entries.add(name, strlen(name), info);
+              }
+          }
+      }
+  }
+} // namespace
+
+/*****************************************************************************/
+T_local_config::T_local_config()
+  : use_io_uring(false),
+    io_queue_depth(32)
+{
+}
+
+/*****************************************************************************/
+T_directory_fd::T_directory_fd(int fd, atomic<uint32_t>& nb_open)
+  : _fd(fd), _nb_open(nb_open)
+{
+}
+
+T_directory_fd::~T_directory_fd()
+{
+  close(_fd);
+  --_nb_open;
+}
+
+/*****************************************************************************/
+T_local_filesystem::T_local_filesystem(T_filesystem_config_ptr conf)
+  : T_filesystem_proxy(conf),
+    _config(dynamic_pointer_cast<T_local_config>(conf)),
+    _on_mapping_miss(N_Security::T_on_uid_mapping_miss()),
+    _nb_open_directories(0),
+    _max_open_directories(max_open_directories)
+{
+  assert(_config.get());
+  _uri_prefix = "file://" + _config->remote_host;
+
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0
+      && limit.rlim_cur / open_directories_ratio < max_open_directories)
+    {
+      _max_open_directories = limit.rlim_cur / open_directories_ratio;
+    }
+  LOG(INFO, 5) << "Directories kept open: " << _max_open_directories;
+
+  if (_config->use_io_uring)
+    {
+      try
+        {
+          _uring.reset(new T_uring_engine(_config->io_queue_depth));
+          LOG(INFO, 5) << "I/O engine: io_uring, queue depth "
+                       << _uring->queue_depth();
+        }
+      catch(E_system& e)
+        {
+          LOG(WARNING, 2) << "io_uring not available, using synchronous I/O ("
+                          << e << ")";
+        }
+    }
+}
+
+/*****************************************************************************/
+T_local_filesystem::~T_local_filesystem()
+{
+}
+
+/*****************************************************************************/
+void T_local_filesystem::connect()
+{
+  LOG(INFO, 5) << "Local filesystem root: " << _config->root_path;
+  struct stat root_stat;
+  if (stat(_config->root_path.c_str(), &root_stat) < 0)
+    {
+      string errmsg (strerror(errno));
+      throw E_system("Could not access local root directory: "
+                     + _config->root_path + ": " + errmsg);
+    }
+  if (not S_ISDIR(root_stat.st_mode))
+    {
+      throw E_system("Could not access local root directory: "
+                     + _config->root_path + ": " + strerror(ENOTDIR));
+    }
+}
+
+/*****************************************************************************/
+void T_local_filesystem::disconnect()
+{
+}
+
+/*****************************************************************************/
+T_url_ptr
+T_local_filesystem::create_url(const N_Uri::T_uri& uri) const
+{
+  return T_url_ptr(new T_local_url(uri, *this));
+}
+
+/*****************************************************************************/
+T_url_ptr
+T_local_filesystem::create_url(const std::string& fs_path) const
+{
+  return T_url_ptr(new T_local_url(fs_path, *this));
+}
+
+/*****************************************************************************/
+T_url_ptr
+T_local_filesystem::create_entry_url(const T_url& directory,
+                                     const std::string& fs_path) const
+{
+  T_url_ptr url = create_url(fs_path);
+  // URLs of this filesystem are all local ones
+  const T_local_url& local_directory = static_cast<const T_local_url&>(directory);
+  if (local_directory.get_directory())
+    {
+      static_cast<T_local_url&>(*url).set_parent(local_directory.get_directory(),
+                                                 fs_path.rfind('/') + 1);
+    }
+  return url;
+}
+
+/*****************************************************************************/
+bool T_local_filesystem::check_if_file_exists(const T_url& uri)
+{
+  return N_IO::check_if_file_exists(uri.get_local_path());
+}
+
+/*****************************************************************************/
+void T_local_filesystem::list_directory(const T_url& url,
+                                        T_directory_entries& entries)
+{
+  const T_local_url& local_url = static_cast<const T_local_url&>(url);
+  const string& local_path = url.get_local_path();
+  int fd = openat(local_url.at_fd(), local_url.at_path(),
+                  O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+    {
+      string errmsg (strerror(errno));
+      throw E_system("Could not open directory: " + local_path + ": " + errmsg);
+    }
+
+  try
+    {
+      read_entries(fd, local_path, entries);
+    }
+  catch (...)
+    {
+      close(fd);
+      throw;
+    }
+  entries.sort();
+
+  // Entries are resolved from the directory while their URLs exist
+  if (_nb_open_directories++ < _max_open_directories)
+    {
+      local_url.set_directory(T_local_url::T_directory_fd_ptr(
+          new T_directory_fd(fd, _nb_open_directories)));
+    }
+  else
+    {
+      --_nb_open_directories;
+      close(fd);
+    }
+}
+
+/*****************************************************************************/
+bool
+T_local_filesystem::read_file_content(const T_url& uri,
+                                      const T_file_info& info,
+                                      string& data,
+                                      uint64_t max_size)
+{
+  const T_local_url& local_url = static_cast<const T_local_url&>(uri);
+  const string& local_path = uri.get_local_path();
+  LOG(INFO, 5) << "Reading content of " <<  local_path;
+  int fd = openat(local_url.at_fd(), local_url.at_path(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    {
+      string errmsg (strerror(errno));
+      throw E_system("Could not open file: " + local_path + ": " + errmsg);
+    }
+
+  try
+    {
+      bool complete = read_chunks(boost::bind(::read, fd, _1, _2), read_chunk_size,
+                                  info.size, data, max_size);
+      close(fd);
+      return complete;
+    }
+  catch (...)
+    {
+      close(fd);
+      throw;
+    }
+}
+
+/*****************************************************************************/
+uint32_t T_local_filesystem::io_batch_size() const
+{
+  return _uring.get() ? _uring->queue_depth() : 1;
+}
+
+/*****************************************************************************/
+void T_local_filesystem::read_files_content(std::vector<T_content_read>& reads,
+                                            uint64_t max_size)
+{
+  if (not _uring.get())
+    {
+      T_filesystem_proxy::read_files_content(reads, max_size);
+      return;
+    }
+
+  std::vector<T_read_request> requests;
+  requests.reserve(reads.size());
+  for (size_t i = 0; i < reads.size(); ++i)
+    {
+      const T_local_url& local_url = static_cast<const T_local_url&>(*reads[i].url);
+      LOG(INFO, 5) << "Reading content of " << local_url.get_local_path();
+      requests.push_back(T_read_request(local_url.at_fd(), local_url.at_path(),
+                                        reads[i].info->size, *reads[i].data));
+    }
+  try
+    {
+      _uring->read_files(requests, max_size);
+    }
+  catch(E_system& e)
+    {
+      LOG(WARNING, 2) << "io_uring failed, reading files one by one (" << e << ")";
+      T_filesystem_proxy::read_files_content(reads, max_size);
+      return;
+    }
+
+  for (size_t i = 0; i < reads.size(); ++i)
+    {
+      reads[i].complete = requests[i].complete;
+      if (requests[i].error != 0)
+        {
+          reads[i].error = "Could not read file: " + reads[i].url->get_local_path()
+                           + ": " + strerror(requests[i].error);
+        }
+    }
+}
+
+/*****************************************************************************/
+ACL
+T_local_filesystem::read_url_permissions(const T_url& uri)
+{
+  return read_url_permissions(uri.get_local_path());
+}
+
+/*****************************************************************************/
+ACL
+T_local_filesystem::read_url_permissions(const string& uri)
+{
+  LOG(INFO, 5) << "Reading permissions of " <<  uri;
+  return build_acl_from_unix_path(uri,
+                                  _config->users_mapping,
+                                  _config->groups_mapping,
+                                  _on_mapping_miss.local());
+}
+
+/*****************************************************************************/
+const map<uint32_t, uint32_t> T_local_filesystem::user_misses() const
+{
+  map<uint32_t, uint32_t> misses;
+  BOOST_FOREACH(const T_on_uid_mapping_miss& shard, _on_mapping_miss.all())
+    {
+      merge_misses(misses, shard.user_misses);
+    }
+  return misses;
+}
+
+const map<uint32_t, uint32_t> T_local_filesystem::group_misses() const
+{
+  map<uint32_t, uint32_t> misses;
+  BOOST_FOREACH(const T_on_uid_mapping_miss& shard, _on_mapping_miss.all())
+    {
+      merge_misses(misses, shard.group_misses);
+    }
+  return misses;
+}
+
+/*****************************************************************************/
+void
+T_local_filesystem::read_file_info(const T_url& uri, T_file_info& info)
+{
+  const T_local_url& local_url = static_cast<const T_local_url&>(uri);
+  struct stat file_stat;
+  if (fstatat(local_url.at_fd(), local_url.at_path(), &file_stat, 0) < 0)
+    {
+      string errmsg (strerror(errno));
+      throw E_system("Could not stat file: " + uri.get_local_path() + ": " + errmsg);
+    }
+  info.set(file_stat);
+}
+
+/*****************************************************************************/
+void
+T_local_filesystem::read_entries_info(const T_url& directory,
+                                      T_directory_entries& entries,
+                                      const std::vector<size_t>& indices)
+{
+  if (not _uring.get() || indices.empty())
+    {
+      return;
+    }
+
+  // Entries are stat'ed by name from the listed directory if still open
+  const T_local_url& local_directory = static_cast<const T_local_url&>(directory);
+  int dir_fd = local_directory.get_directory()
+               ? local_directory.get_directory()->fd() : AT_FDCWD;
+  string prefix = (dir_fd == AT_FDCWD) ? directory.get_local_path() + "/" : "";
+
+  std::vector<string> paths;
+  std::vector<size_t> stated;
+  paths.reserve(indices.size());
+  for (size_t i = 0; i < indices.size(); ++i)
+    {
+      if (not entries.info(indices[i]).has_attributes)
+        {
+          paths.push_back(prefix);
+          paths.back().append(entries.name_data(indices[i]),
+                              entries.name_length(indices[i]));
+          stated.push_back(indices[i]);
+        }
+    }
+  std::vector<T_stat_request> requests;
+  requests.reserve(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i)
+    {
+      requests.push_back(T_stat_request(dir_fd, paths[i].c_str()));
+    }
+
+  try
+    {
+      _uring->stat_at(requests);
+    }
+  catch(E_system& e)
+    {
+      LOG(WARNING, 2) << "io_uring failed, reading attributes one by one ("
+                      << e << ")";
+      return;
+    }
+  for (size_t i = 0; i < requests.size(); ++i)
+    {
+      if (requests[i].error == 0)
+        {
+          entries.info(stated[i]).set(requests[i].result);
+        }
+    }
+}
+
+/*****************************************************************************/
+T_local_acl::T_local_acl(T_local_filesystem& local_fs)
+ : T_filesystem_acl(local_fs), _local(local_fs)
+{
+}
+
+T_local_acl::T_local_acl(T_local_filesystem& local_fs, T_filesystem_proxy& reader)
+ : T_filesystem_acl(reader), _local(local_fs)
+{
+}
+
+/*****************************************************************************/
+T_local_acl::~T_local_acl()
+{
+}
+
+/*****************************************************************************/
+SAR T_local_acl::compute_sar_layer(const T_url& uri)
+{
+  return build_sar_from_unix_acl(uri.get_local_path(),
+                                 *this);
+}
+
+/*****************************************************************************/
+void T_local_acl::log_mapping_errors(AFS::PaF::Handle& handle)
+{
+  log_mapping_errors(handle, _local.user_misses(), "USER");
+  log_mapping_errors(handle, _local.group_misses(), "GROUP");
+}
+
+/*****************************************************************************/
+void T_local_acl::log_mapping_errors(AFS::PaF::Handle& handle,
+                                     const map< uint32_t, uint32_t >& errors,
+                                     string mapping_type)
+{
+  if (!errors.empty())
+    {
+      ostringstream msg;
+      msg << "Found " << errors.size() << " "
+          << mapping_type << ((errors.size() > 1) ? "S" : "")
+          << " without mapping";
+      handle.log(N_Event::WARNING, msg.str());
+
+      for (map<uint32_t, uint32_t>::const_iterator it = errors.begin();
+           it != errors.end();
+           ++it)
+        {
+          ostringstream msg;
+          msg << "Could not find mapping for "
+              << mapping_type << " with uid=" << it->first
+              << " (" << it->second << " occurence(s))";
+          handle.log(N_Event::WARNING, msg.str());
+        }
+    }
+}
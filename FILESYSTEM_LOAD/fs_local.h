@@ -0,0 +1,159 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Local filesystem accessed through directory descriptors
+ *
+ ***************************************************************************/
+#ifndef _FILESYSTEM_LOCAL_H_
+#define _FILESYSTEM_LOCAL_H_
+
+#include "fs_proxy.h"
+#include "fs_shards.h"
+#include "fs_uring.h"
+
+#include <AFS/SECURITY/unix_acl.h>
+#include <PaF/API/filter.h>
+
+#include <boost/atomic.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+
+typedef std::map<uint32_t, std::string> uid_gid_mapping_t;
+
+/*****************************************************************************/
+struct T_local_config : public T_filesystem_config {
+  T_local_config();
+
+  std::string   root_path; // local directory under which files are loaded
+  bool          use_io_uring;   // batch stat and reads, see T_uring_engine
+  uint32_t      io_queue_depth; // operations in flight with io_uring
+  uid_gid_mapping_t users_mapping;
+  uid_gid_mapping_t groups_mapping;
+};
+
+typedef boost::shared_ptr<T_local_config> T_local_config_ptr;
+
+/*****************************************************************************/
+//! @brief An open directory, shared by the URLs of its entries
+class T_directory_fd : private boost::noncopyable
+{
+public:
+  //! @param nb_open counter of open directories, decremented when closed
+  T_directory_fd(int fd, boost::atomic<uint32_t>& nb_open);
+  ~T_directory_fd();
+
+  int fd() const { return _fd; }
+
+private:
+  int                       _fd;
+  boost::atomic<uint32_t>&  _nb_open;
+};
+
+/*****************************************************************************/
+//! @brief A filesystem available under a local path ("file" protocol)
+//! A listed directory is kept open while URLs of its entries exist: its
+//! files and subdirectories are then opened, stat'ed and listed relative to
+//! it (openat, fstatat, getdents64), the kernel resolves only their name.
+//! With io_uring, attributes and contents of the files of a directory are
+//! read by batches. Safe for concurrent use.
+class T_local_filesystem : public T_filesystem_proxy
+{
+public:
+  T_local_filesystem(T_filesystem_config_ptr conf);
+  virtual ~T_local_filesystem();
+
+  const std::string& root_path() const { return _config->root_path; }
+  //! @brief URI prefix of the local paths below the root
+  //! ie file://host, or nfs://host/remote_path for a mount
+  const std::string& uri_prefix() const { return _uri_prefix; }
+  //! @brief False if io_uring was not requested or is not available
+  bool uses_io_uring() const { return _uring.get() != NULL; }
+  //! @brief Mapping misses of all threads, once the crawl is over
+  const map<uint32_t, uint32_t> user_misses() const;
+  const map<uint32_t, uint32_t> group_misses() const;
+
+  //! @exception E_system if the root directory cannot be accessed
+  virtual void connect();
+  virtual void disconnect();
+
+  virtual T_url_ptr create_url(const N_Uri::T_uri& uri) const;
+  virtual T_url_ptr create_url(const std::string& fs_path) const;
+  virtual T_url_ptr create_entry_url(const T_url& directory,
+                                     const std::string& fs_path) const;
+  virtual bool check_if_file_exists(const T_url& url);
+  virtual void list_directory(const T_url& url,
+                              T_directory_entries& entries);
+  virtual bool read_file_content(const T_url& url,
+                                 const T_file_info& info,
+                                 std::string& data,
+                                 uint64_t max_size);
+  virtual uint32_t io_batch_size() const;
+  virtual void read_files_content(std::vector<T_content_read>& reads,
+                                  uint64_t max_size);
+  virtual N_Security::ACL read_url_permissions(const T_url& url);
+  virtual N_Security::ACL read_url_permissions(const string& localpath) ;
+  virtual void read_file_info(const T_url& url, T_file_info& info);
+  virtual void read_entries_info(const T_url& directory,
+                                 T_directory_entries& entries,
+                                 const std::vector<size_t>& indices);
+
+protected:
+  std::string _uri_prefix;
+
+private:
+  T_local_config_ptr _config;
+  // Mappings are read-only after init, misses are counted by each thread
+  T_thread_shards<N_Security::T_on_uid_mapping_miss> _on_mapping_miss;
+  // Directories kept open, bounded by the limit of file descriptors
+  mutable boost::atomic<uint32_t> _nb_open_directories;
+  uint32_t _max_open_directories;
+  boost::scoped_ptr<T_uring_engine> _uring; // NULL for synchronous I/O
+};
+
+/*****************************************************************************/
+class T_local_acl: public T_filesystem_acl
+{
+public:
+  T_local_acl(T_local_filesystem&);
+  //! @param reader proxy permissions are read through (eg instrumented)
+  T_local_acl(T_local_filesystem&, T_filesystem_proxy& reader);
+  virtual ~T_local_acl();
+
+  //! @brief Compute SAR layer
+  virtual N_Security::SAR compute_sar_layer(const T_url& url);
+
+  //! @brief Log the uuid/guid mapping errors
+  virtual void log_mapping_errors(AFS::PaF::Handle& handle);
+
+protected:
+  //! @brief Unix SAR depends on permissions of all ancestors
+  virtual bool inherits_ancestors_acls() const { return true; }
+
+private:
+  T_local_filesystem& _local;
+
+  void log_mapping_errors(AFS::PaF::Handle& handle,
+                          const map<uint32_t, uint32_t>& errors,
+                          std::string mapping_type);
+};
+
+#endif // _FILESYSTEM_LOCAL_H_
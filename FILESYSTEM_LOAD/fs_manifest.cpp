@@ -0,0 +1,145 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Manifest of the entries seen by a crawl
+ *
+ ***************************************************************************/
+
+#include "fs_manifest.h"
+#include "fs_proxy.h"
+
+#include <algorithm>
+
+using namespace boost;
+
+namespace {
+  // FNV-1a 64 bits
+  static const uint64_t fnv_offset_basis = 14695981039346656037ULL;
+  static const uint64_t fnv_prime = 1099511628211ULL;
+
+  inline uint64_t fnv_append(uint64_t hash, const char* data, size_t length)
+  {
+    for (size_t i = 0; i < length; ++i)
+      {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * fnv_prime;
+      }
+    return hash;
+  }
+
+  inline size_t path_length(const std::string& path)
+  {
+    size_t length = path.length();
+    while (length > 1 && path[length - 1] == '/')
+      {
+        --length;
+      }
+    return length;
+  }
+} // namespace
+
+/*****************************************************************************/
+T_crawl_manifest::T_crawl_manifest()
+  : _frozen(false)
+{
+}
+
+/*****************************************************************************/
+uint64_t T_crawl_manifest::fingerprint(const std::string& path)
+{
+  return fingerprint(path, path_length(path));
+}
+
+/*****************************************************************************/
+uint64_t T_crawl_manifest::fingerprint(const std::string& path, size_t length)
+{
+  return fnv_append(fnv_offset_basis, path.data(), length);
+}
+
+/*****************************************************************************/
+void T_crawl_manifest::add_listing(const std::string& directory_path,
+                                   const T_directory_entries& entries)
+{
+  // Fingerprints of "directory_path/name": the directory part is hashed once
+  uint64_t prefix_hash = fnv_append(fnv_offset_basis, directory_path.data(),
+                                    directory_path.size());
+  if (directory_path.empty() || directory_path[directory_path.size() - 1] != '/')
+    {
+      prefix_hash = fnv_append(prefix_hash, "/", 1);
+    }
+  std::vector<uint64_t> fingerprints;
+  fingerprints.reserve(entries.size());
+  for (size_t i = 0; i < entries.size(); ++i)
+    {
+      fingerprints.push_back(fnv_append(prefix_hash, entries.name_data(i),
+                                        entries.name_length(i)));
+    }
+
+  mutex::scoped_lock lock(_mutex);
+  _directories.push_back(fingerprint(directory_path));
+  _entries.insert(_entries.end(), fingerprints.begin(), fingerprints.end());
+  _frozen = false;
+}
+
+/*****************************************************************************/
+void T_crawl_manifest::freeze()
+{
+  mutex::scoped_lock lock(_mutex);
+  sort_unique(_directories);
+  sort_unique(_entries);
+  _frozen = true;
+}
+
+/*****************************************************************************/
+void T_crawl_manifest::sort_unique(std::vector<uint64_t>& fingerprints)
+{
+  std::sort(fingerprints.begin(), fingerprints.end());
+  fingerprints.erase(std::unique(fingerprints.begin(), fingerprints.end()),
+                     fingerprints.end());
+}
+
+/*****************************************************************************/
+bool T_crawl_manifest::is_in_scope(const std::string& path) const
+{
+  assert(_frozen);
+  std::string::size_type parent_length = path.rfind('/', path_length(path) - 1);
+  if (parent_length == std::string::npos || parent_length == 0)
+    {
+      return false;
+    }
+  return std::binary_search(_directories.begin(), _directories.end(),
+                            fingerprint(path, parent_length));
+}
+
+/*****************************************************************************/
+bool T_crawl_manifest::contains(const std::string& path) const
+{
+  assert(_frozen);
+  return std::binary_search(_entries.begin(), _entries.end(), fingerprint(path));
+}
+
+/*****************************************************************************/
+bool T_crawl_manifest::is_listed(const std::string& directory_path) const
+{
+  assert(_frozen);
+  return std::binary_search(_directories.begin(), _directories.end(),
+                            fingerprint(directory_path));
+}
@@ -0,0 +1,86 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Manifest of the entries seen by a crawl
+ *
+ ***************************************************************************/
+#ifndef _FILESYSTEM_MANIFEST_H_
+#define _FILESYSTEM_MANIFEST_H_
+
+#include <COMMON/META/antidot.h>
+
+#include <boost/thread/mutex.hpp>
+
+#include <string>
+#include <vector>
+
+class T_directory_entries;
+
+/*****************************************************************************/
+//! @brief Compact record of the directory listings made during a run
+//! Paths are stored as 64-bit fingerprints, so a lookup of a path that was
+//! not recorded is wrong with a probability of about n / 2^64 for n recorded
+//! paths. An entry collision keeps a deleted document. A directory collision
+//! puts the files of an unlisted directory in scope: contains() is then
+//! false and an existing document is deleted without probing the filesystem.
+//! Recording is thread-safe, lookups are allowed once the manifest is frozen.
+class T_crawl_manifest
+{
+public:
+  T_crawl_manifest();
+
+  //! @brief Record a successfully listed directory and its entries
+  //! @param directory_path path of the directory
+  //! @param entries all its entries (before filtering)
+  void add_listing(const std::string& directory_path,
+                   const T_directory_entries& entries);
+
+  //! @brief Sort the recorded paths, must be called before lookups
+  void freeze();
+
+  //! @brief Returns true if the parent directory of path was listed
+  //! If so, contains() tells if the path still exists.
+  bool is_in_scope(const std::string& path) const;
+
+  //! @brief Returns true if the path was found in a listing
+  bool contains(const std::string& path) const;
+
+  //! @brief Returns true if the directory itself was listed
+  bool is_listed(const std::string& directory_path) const;
+
+  //! @brief Number of recorded entries
+  size_t size() const { return _entries.size(); }
+
+  //! @brief 64-bit fingerprint of a path, ignoring any trailing slash
+  static uint64_t fingerprint(const std::string& path);
+
+private:
+  boost::mutex          _mutex;
+  bool                  _frozen;
+  std::vector<uint64_t> _directories;
+  std::vector<uint64_t> _entries;
+
+  static uint64_t fingerprint(const std::string& path, size_t length);
+  static void sort_unique(std::vector<uint64_t>& fingerprints);
+};
+
+#endif // _FILESYSTEM_MANIFEST_H_
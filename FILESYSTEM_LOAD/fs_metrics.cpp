@@ -0,0 +1,345 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Latency histograms and counters of filesystem and PaF calls
+ *
+ ***************************************************************************/
+
+#include "fs_metrics.h"
+
+#include <COMMON/BASIC/log.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+using namespace boost;
+
+namespace {
+  const char* operation_names[T_filesystem_metrics::NB_OPERATIONS] =
+    {
+      "readdir", "stat", "read", "permissions", "exists",
+      "acl", "sar",
+      "get_document", "get_where", "send", "delete_documents"
+    };
+
+  //! @brief Latency for humans: 850us, 12.5ms, 3.2s
+  std::string format_latency(uint64_t latency_us)
+  {
+    char buffer[32];
+    if (latency_us < 1000)
+      {
+        snprintf(buffer, sizeof(buffer), "%luus",
+                 static_cast<unsigned long>(latency_us));
+      }
+    else if (latency_us < 1000000)
+      {
+        snprintf(buffer, sizeof(buffer), "%.1fms", latency_us / 1e3);
+      }
+    else
+      {
+        snprintf(buffer, sizeof(buffer), "%.1fs", latency_us / 1e6);
+      }
+    return buffer;
+  }
+} // namespace
+
+/*****************************************************************************/
+uint64_t T_operation_metrics::T_snapshot::percentile(double ratio) const
+{
+  uint64_t nb_recorded = 0;
+  for (size_t i = 0; i < buckets.size(); ++i)
+    {
+      nb_recorded += buckets[i];
+    }
+  if (nb_recorded == 0)
+    {
+      return 0;
+    }
+
+  uint64_t rank = std::max<uint64_t>(static_cast<uint64_t>(ratio * nb_recorded + 0.5), 1);
+  uint64_t nb_below = 0;
+  for (size_t i = 0; i < buckets.size(); ++i)
+    {
+      nb_below += buckets[i];
+      if (nb_below >= rank)
+        {
+          return std::min(get_bucket_limit(i), max_us);
+        }
+    }
+  return max_us;
+}
+
+/*****************************************************************************/
+T_operation_metrics::T_operation_metrics()
+  : _nb_calls(0),
+    _nb_items(0),
+    _nb_errors(0),
+    _bytes(0),
+    _total_us(0),
+    _max_us(0)
+{
+  for (size_t i = 0; i < nb_buckets; ++i)
+    {
+      _buckets[i].store(0, memory_order_relaxed);
+    }
+}
+
+/*****************************************************************************/
+size_t T_operation_metrics::get_bucket(uint64_t latency_us)
+{
+  if (latency_us < nb_sub_buckets)
+    {
+      return latency_us;
+    }
+  // Highest bit selects the power of two, next bits the sub-bucket
+  unsigned shift = 63 - __builtin_clzll(latency_us) - sub_bucket_bits;
+  size_t bucket = (shift + 1) * nb_sub_buckets
+                  + (latency_us >> shift) - nb_sub_buckets;
+  return std::min<size_t>(bucket, nb_buckets - 1);
+}
+
+uint64_t T_operation_metrics::get_bucket_limit(size_t bucket)
+{
+  if (bucket < nb_sub_buckets)
+    {
+      return bucket;
+    }
+  if (bucket == nb_buckets - 1)
+    {
+      // Also holds all the larger latencies
+      return ~static_cast<uint64_t>(0);
+    }
+  unsigned shift = bucket / nb_sub_buckets - 1;
+  uint64_t lowest = static_cast<uint64_t>(nb_sub_buckets + bucket % nb_sub_buckets)
+                    << shift;
+  return lowest + (static_cast<uint64_t>(1) << shift) - 1;
+}
+
+/*****************************************************************************/
+void T_operation_metrics::record(uint64_t latency_us,
+                                 uint64_t bytes,
+                                 uint64_t nb_items,
+                                 uint64_t nb_errors)
+{
+  _nb_calls.fetch_add(1, memory_order_relaxed);
+  _nb_items.fetch_add(nb_items, memory_order_relaxed);
+  _nb_errors.fetch_add(nb_errors, memory_order_relaxed);
+  _bytes.fetch_add(bytes, memory_order_relaxed);
+  _total_us.fetch_add(latency_us, memory_order_relaxed);
+  _buckets[get_bucket(latency_us)].fetch_add(1, memory_order_relaxed);
+
+  uint64_t max_us = _max_us.load(memory_order_relaxed);
+  while (latency_us > max_us
+         && not _max_us.compare_exchange_weak(max_us, latency_us,
+                                              memory_order_relaxed))
+    {
+    }
+}
+
+/*****************************************************************************/
+T_operation_metrics::T_snapshot T_operation_metrics::snapshot() const
+{
+  // Concurrent calls may be partly counted: good enough for reporting
+  T_snapshot snapshot;
+  snapshot.nb_calls = _nb_calls.load(memory_order_relaxed);
+  snapshot.nb_items = _nb_items.load(memory_order_relaxed);
+  snapshot.nb_errors = _nb_errors.load(memory_order_relaxed);
+  snapshot.bytes = _bytes.load(memory_order_relaxed);
+  snapshot.total_us = _total_us.load(memory_order_relaxed);
+  snapshot.max_us = _max_us.load(memory_order_relaxed);
+  snapshot.buckets.resize(nb_buckets);
+  for (size_t i = 0; i < nb_buckets; ++i)
+    {
+      snapshot.buckets[i] = _buckets[i].load(memory_order_relaxed);
+    }
+  return snapshot;
+}
+
+/*****************************************************************************/
+T_filesystem_metrics::T_filesystem_metrics()
+  : _start_us(T_timed_operation::now_us())
+{
+}
+
+/*****************************************************************************/
+const char* T_filesystem_metrics::get_name(Operation operation)
+{
+  return operation_names[operation];
+}
+
+/*****************************************************************************/
+void T_filesystem_metrics::format(std::vector<std::string>& lines) const
+{
+  double elapsed = std::max<uint64_t>(T_timed_operation::now_us() - _start_us, 1)
+                   / 1e6;
+  for (int i = 0; i < NB_OPERATIONS; ++i)
+    {
+      T_operation_metrics::T_snapshot snapshot = _operations[i].snapshot();
+      if (snapshot.nb_calls == 0)
+        {
+          continue;
+        }
+      std::ostringstream line;
+      line << "Metrics " << operation_names[i] << ": "
+           << snapshot.nb_calls << " call(s)";
+      if (snapshot.nb_items != snapshot.nb_calls)
+        {
+          line << " for " << snapshot.nb_items << " item(s)";
+        }
+      line << ", " << snapshot.nb_errors << " error(s)";
+      if (snapshot.bytes > 0)
+        {
+          char bytes[32];
+          snprintf(bytes, sizeof(bytes), "%.1f", snapshot.bytes / (1024.0 * 1024.0));
+          line << ", " << bytes << " MB";
+        }
+      char rate[32];
+      snprintf(rate, sizeof(rate), "%.1f", snapshot.nb_calls / elapsed);
+      line << ", " << rate << " call(s)/s"
+           << ", mean " << format_latency(snapshot.total_us / snapshot.nb_calls)
+           << " p50 " << format_latency(snapshot.percentile(0.5))
+           << " p90 " << format_latency(snapshot.percentile(0.9))
+           << " p99 " << format_latency(snapshot.percentile(0.99))
+           << " max " << format_latency(snapshot.max_us);
+      lines.push_back(line.str());
+    }
+}
+
+/*****************************************************************************/
+void T_filesystem_metrics::save(const std::string& filepath) const
+{
+  std::string tmp_filepath = filepath + ".tmp";
+  {
+    std::ofstream out(tmp_filepath.c_str(), std::ios::trunc);
+    out << "# elapsed_us " << (T_timed_operation::now_us() - _start_us) << "\n"
+        << "# operation calls items errors bytes total_us mean_us"
+        << " p50_us p90_us p99_us p999_us max_us\n";
+    for (int i = 0; i < NB_OPERATIONS; ++i)
+      {
+        T_operation_metrics::T_snapshot snapshot = _operations[i].snapshot();
+        out << operation_names[i]
+            << " " << snapshot.nb_calls
+            << " " << snapshot.nb_items
+            << " " << snapshot.nb_errors
+            << " " << snapshot.bytes
+            << " " << snapshot.total_us
+            << " " << ((snapshot.nb_calls > 0)
+                       ? snapshot.total_us / snapshot.nb_calls : 0)
+            << " " << snapshot.percentile(0.5)
+            << " " << snapshot.percentile(0.9)
+            << " " << snapshot.percentile(0.99)
+            << " " << snapshot.percentile(0.999)
+            << " " << snapshot.max_us << "\n";
+      }
+    out.close();
+    if (out.fail())
+      {
+        throw E_system("Could not write metrics file: " + tmp_filepath);
+      }
+  }
+  if (rename(tmp_filepath.c_str(), filepath.c_str()) < 0)
+    {
+      throw E_system("Could not replace metrics file: " + filepath
+                     + ": " + strerror(errno));
+    }
+}
+
+/*****************************************************************************/
+T_timed_operation::T_timed_operation(T_operation_metrics& metrics)
+  : _metrics(metrics),
+    _start_us(now_us()),
+    _done(false)
+{
+}
+
+T_timed_operation::~T_timed_operation()
+{
+  if (not _done)
+    {
+      _metrics.record(now_us() - _start_us, 0, 1, 1);
+    }
+}
+
+/*****************************************************************************/
+void T_timed_operation::done(uint64_t bytes, uint64_t nb_items, uint64_t nb_errors)
+{
+  _metrics.record(now_us() - _start_us, bytes, nb_items, nb_errors);
+  _done = true;
+}
+
+/*****************************************************************************/
+uint64_t T_timed_operation::now_us()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+/*****************************************************************************/
+T_metrics_reporter::T_metrics_reporter(T_report_fn report, uint32_t interval)
+  : _report(report),
+    _interval(std::max(interval, 1U)),
+    _stopped(false)
+{
+  _thread.reset(new thread(bind(&T_metrics_reporter::reporter_loop, this)));
+}
+
+/*****************************************************************************/
+T_metrics_reporter::~T_metrics_reporter()
+{
+  {
+    mutex::scoped_lock lock(_mutex);
+    _stopped = true;
+    _changed.notify_all();
+  }
+  _thread->join();
+}
+
+/*****************************************************************************/
+void T_metrics_reporter::reporter_loop()
+{
+  mutex::scoped_lock lock(_mutex);
+  while (not _stopped)
+    {
+      system_time deadline = get_system_time() + posix_time::seconds(_interval);
+      // Until the deadline, unless stopped before
+      while (not _stopped && _changed.timed_wait(lock, deadline))
+        {
+        }
+      if (_stopped)
+        {
+          return;
+        }
+      lock.unlock();
+      _report();
+      lock.lock();
+    }
+}
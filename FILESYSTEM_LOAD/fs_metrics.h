@@ -0,0 +1,178 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Latency histograms and counters of filesystem and PaF calls
+ *
+ ***************************************************************************/
+
+#ifndef _FILESYSTEM_METRICS_H_
+#define _FILESYSTEM_METRICS_H_
+
+#include <COMMON/META/antidot.h>
+
+#include <boost/atomic.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <string>
+#include <vector>
+
+namespace boost { class thread; }
+
+/*****************************************************************************/
+//! @brief Calls, items, errors, bytes and latencies of an operation
+//! Latencies are counted in log-linear buckets (HDR histogram): 16 buckets
+//! per power of two, so percentiles are exact within 1/16. All methods are
+//! thread-safe and lock-free.
+class T_operation_metrics : private boost::noncopyable
+{
+public:
+  enum { sub_bucket_bits = 4,
+         nb_sub_buckets = 1 << sub_bucket_bits,
+         nb_buckets = 40 * nb_sub_buckets };  // up to 2^43 us
+
+  //! @brief Values read at once, for reporting
+  struct T_snapshot
+  {
+    uint64_t nb_calls;
+    uint64_t nb_items;
+    uint64_t nb_errors;
+    uint64_t bytes;
+    uint64_t total_us;
+    uint64_t max_us;
+    std::vector<uint64_t> buckets;
+
+    //! @brief Latency under which a ratio of the calls completed
+    //! @param ratio in [0, 1], eg 0.99
+    uint64_t percentile(double ratio) const;
+  };
+
+  T_operation_metrics();
+
+  //! @brief Record a completed call
+  //! @param nb_items files or documents handled by a batched call
+  //! @param nb_errors items that failed
+  void record(uint64_t latency_us, uint64_t bytes, uint64_t nb_items,
+              uint64_t nb_errors);
+
+  T_snapshot snapshot() const;
+
+private:
+  boost::atomic<uint64_t> _nb_calls;
+  boost::atomic<uint64_t> _nb_items;
+  boost::atomic<uint64_t> _nb_errors;
+  boost::atomic<uint64_t> _bytes;
+  boost::atomic<uint64_t> _total_us;
+  boost::atomic<uint64_t> _max_us;
+  boost::atomic<uint64_t> _buckets[nb_buckets];
+
+  static size_t get_bucket(uint64_t latency_us);
+  //! @brief Highest latency counted in a bucket
+  static uint64_t get_bucket_limit(size_t bucket);
+};
+
+/*****************************************************************************/
+//! @brief Metrics of the filesystem and PaF calls of a run
+class T_filesystem_metrics : private boost::noncopyable
+{
+public:
+  enum Operation
+  {
+    // Filesystem proxy
+    READDIR, STAT, READ, PERMISSIONS, EXISTS,
+    // Security layers
+    ACL, SAR,
+    // PaF
+    GET_DOCUMENT, GET_WHERE, SEND, DELETE_DOCUMENTS,
+    NB_OPERATIONS
+  };
+
+  T_filesystem_metrics();
+
+  static const char* get_name(Operation operation);
+
+  T_operation_metrics& operator[](Operation operation)
+  { return _operations[operation]; }
+
+  //! @brief One summary line per operation called so far
+  void format(std::vector<std::string>& lines) const;
+
+  //! @brief Write all the operations in a text file, replaced at once
+  //! One line per operation: name, calls, items, errors, bytes, total,
+  //! mean, p50, p90, p99, p999 and max latencies in microseconds.
+  //! @exception E_system if the file cannot be written
+  void save(const std::string& filepath) const;
+
+private:
+  T_operation_metrics _operations[NB_OPERATIONS];
+  uint64_t            _start_us;
+};
+
+/*****************************************************************************/
+//! @brief Measures a call, recorded as failed unless done() is called
+//! (ie if the call throws)
+class T_timed_operation : private boost::noncopyable
+{
+public:
+  T_timed_operation(T_operation_metrics& metrics);
+  ~T_timed_operation();
+
+  void done(uint64_t bytes = 0, uint64_t nb_items = 1, uint64_t nb_errors = 0);
+  //! @brief Record nothing, eg the call did no I/O
+  void cancel() { _done = true; }
+
+  //! @brief Monotonic clock, in microseconds
+  static uint64_t now_us();
+
+private:
+  T_operation_metrics&  _metrics;
+  uint64_t              _start_us;
+  bool                  _done;
+};
+
+/*****************************************************************************/
+//! @brief Calls a report function periodically from a background thread
+class T_metrics_reporter : private boost::noncopyable
+{
+public:
+  typedef boost::function<void ()> T_report_fn;
+
+  //! @param interval seconds between two reports
+  T_metrics_reporter(T_report_fn report, uint32_t interval);
+  //! @brief Stops reporting and waits for the background thread
+  ~T_metrics_reporter();
+
+private:
+  T_report_fn                       _report;
+  uint32_t                          _interval;
+  boost::mutex                      _mutex;
+  boost::condition_variable         _changed;
+  bool                              _stopped;
+  boost::scoped_ptr<boost::thread>  _thread;
+
+  void reporter_loop();
+};
+
+#endif // _FILESYSTEM_METRICS_H_
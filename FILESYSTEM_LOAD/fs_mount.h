@@ -26,28 +26,22 @@ https://github.com/antidot/AIF-Filters/
 #ifndef _FILESYSTEM_MOUNT_H_
 #define _FILESYSTEM_MOUNT_H_
 
-#include "fs_proxy.h"
-
-#include <AFS/SECURITY/unix_acl.h>
-#include <PaF/API/filter.h>
-
-typedef std::map<uint32_t, std::string> uid_gid_mapping_t;
+#include "fs_local.h"
 
 /*****************************************************************************/
-struct T_mount_config : public T_filesystem_config {
+struct T_mount_config : public T_local_config {
   std::string   remote_path;
   std::string   mount_point;
   std::string   mount_options;
-  uid_gid_mapping_t users_mapping;
-  uid_gid_mapping_t groups_mapping;
 };
 
 typedef boost::shared_ptr<T_mount_config> T_mount_config_ptr;
 
 /*****************************************************************************/
 //! @brief An implementation of filesystem proxy for mounted filesystem
+//! Files are accessed as local files under the mount point.
 //FIXME Currently only working with NFS!
-class T_mounted_filesystem : public T_filesystem_proxy
+class T_mounted_filesystem : public T_local_filesystem
 {
 public:
   T_mounted_filesystem(T_filesystem_config_ptr conf);
@@ -57,53 +51,15 @@ public:
   const std::string& path() const { return _config->remote_path; }
   const std::string& mount_point() const { return _config->mount_point; }
   const std::string& mount_options() const { return _config->mount_options; }
-  const map<uint32_t, uint32_t> user_misses() const
-  { return _on_mapping_miss.user_misses; }
-  const map<uint32_t, uint32_t> group_misses() const
-  { return _on_mapping_miss.group_misses; }
 
   virtual void connect();
   virtual void disconnect();
 
   virtual T_url_ptr create_url(const N_Uri::T_uri& uri) const;
   virtual T_url_ptr create_url(const std::string& fs_path) const;
-  virtual bool check_if_dir_exists(const T_url& url);
-  virtual bool check_if_file_exists(const T_url& url);
-  virtual void get_directory_files(const T_url& url,
-                                   std::set<std::string>& files);
-  virtual void get_directory_subdirectories(const T_url& url,
-                                            std::set<std::string>& subdirectories);
-  virtual void read_file_content(const T_url& url,
-                                 N_String::T_binary_string& data);
-  virtual N_Security::ACL read_url_permissions(const T_url& url);
-  virtual N_Security::ACL read_url_permissions(const string& localpath) ;
-  virtual time_t read_file_mtime(const T_url& url);
-  virtual time_t read_file_ctime(const T_url& url);
 
 private:
   T_mount_config_ptr _config;
-  N_Security::T_on_uid_mapping_miss _on_mapping_miss;
-};
-
-/*****************************************************************************/
-class T_mount_acl: public T_filesystem_acl
-{
-public:
-  T_mount_acl(T_mounted_filesystem&);
-  virtual ~T_mount_acl();
-
-  //! @brief Compute SAR layer
-  virtual N_Security::SAR compute_sar_layer(const T_url& url);
-
-  //! @brief Log the uuid/guid mapping errors
-  virtual void log_mapping_errors(AFS::PaF::Handle& handle);
-
-private:
-  T_mounted_filesystem& _mount;
-
-  void log_mapping_errors(AFS::PaF::Handle& handle,
-                          const map<uint32_t, uint32_t>& errors,
-                          std::string mapping_type);
 };
 
 #endif // _FILESYSTEM_MOUNT_H_
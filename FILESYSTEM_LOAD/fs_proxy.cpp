@@ -25,15 +25,127 @@ https://github.com/antidot/AIF-Filters/
  ***************************************************************************/
 
 #include "fs_proxy.h"
+#include "fs_digest.h"
 #include <COMMON/BASIC/log.h>
 
+#include <errno.h>
+#include <string.h>
+
+#include <algorithm>
+
 using namespace N_Security;
+using namespace boost;
+
+namespace {
+  // Distinct chains of ACLs are few: the cache is reset when larger
+  static const size_t max_sar_cache_size = 65536;
+
+  inline uint64_t combine_keys(uint64_t first, uint64_t second)
+  {
+    uint64_t keys[2] = { first, second };
+    uint64_t key = xxhash64(keys, sizeof(keys));
+    return (key == 0) ? 1 : key;
+  }
+
+  inline std::string get_parent_path(const std::string& path)
+  {
+    size_t end = path.find_last_not_of('/');
+    if (end == std::string::npos)
+      {
+        return "";
+      }
+    size_t slash = path.rfind('/', end);
+    if (slash == std::string::npos)
+      {
+        return "";
+      }
+    return (slash == 0) ? "/" : path.substr(0, slash);
+  }
+} // namespace
 
 T_filesystem_config::~T_filesystem_config()
 {
 
 }
 
+/*****************************************************************************/
+T_file_info::T_file_info(Type file_type)
+  : type(file_type),
+    has_attributes(false),
+    size(0),
+    mtime(0),
+    ctime(0),
+    inode(0),
+    mode(0)
+{
+}
+
+void T_file_info::set(const struct stat& file_stat)
+{
+  type = S_ISDIR(file_stat.st_mode) ? DIRECTORY : REGULAR_FILE;
+  has_attributes = true;
+  size = file_stat.st_size;
+  mtime = file_stat.st_mtime;
+  ctime = file_stat.st_ctime;
+  inode = file_stat.st_ino;
+  mode = file_stat.st_mode;
+}
+
+/*****************************************************************************/
+class T_directory_entries::T_name_less
+{
+public:
+  T_name_less(const std::string& names) : _names(names) {}
+
+  bool operator()(const T_entry& left, const T_entry& right) const
+  {
+    int cmp = memcmp(_names.data() + left.name_offset,
+                     _names.data() + right.name_offset,
+                     std::min(left.name_length, right.name_length));
+    return (cmp < 0) || (cmp == 0 && left.name_length < right.name_length);
+  }
+
+private:
+  const std::string& _names;
+};
+
+void T_directory_entries::add(const char* name,
+                              size_t name_length,
+                              const T_file_info& info)
+{
+  _entries.push_back(T_entry(_names.size(), name_length, info));
+  _names.append(name, name_length);
+}
+
+void T_directory_entries::reserve(size_t nb_entries, size_t names_length)
+{
+  _entries.reserve(nb_entries);
+  _names.reserve(names_length);
+}
+
+void T_directory_entries::clear()
+{
+  _entries.clear();
+  _names.clear();
+}
+
+void T_directory_entries::sort()
+{
+  std::sort(_entries.begin(), _entries.end(), T_name_less(_names));
+}
+
+/*****************************************************************************/
+T_content_read::T_content_read(const T_url& file_url,
+                               const T_file_info& file_info,
+                               std::string& content)
+  : url(&file_url),
+    info(&file_info),
+    data(&content),
+    complete(false)
+{
+}
+
+/*****************************************************************************/
 T_filesystem_proxy::T_filesystem_proxy(T_filesystem_config_ptr conf)
   : _config(conf)
 {
@@ -47,6 +159,93 @@ T_filesystem_proxy::~T_filesystem_proxy()
 {
 }
 
+/*****************************************************************************/
+T_url_ptr T_filesystem_proxy::create_entry_url(const T_url& /* directory */,
+                                               const std::string& fs_path) const
+{
+  return create_url(fs_path);
+}
+
+/*****************************************************************************/
+void T_filesystem_proxy::read_files_content(std::vector<T_content_read>& reads,
+                                            uint64_t max_size)
+{
+  for (size_t i = 0; i < reads.size(); ++i)
+    {
+      T_content_read& read = reads[i];
+      try
+        {
+          read.complete = read_file_content(*read.url, *read.info,
+                                            *read.data, max_size);
+        }
+      catch(E_error& e)
+        {
+          read.error = e.what();
+          read.data->clear();
+        }
+      catch(...)
+        {
+          read.error = "unknown error";
+          read.data->clear();
+        }
+    }
+}
+
+/*****************************************************************************/
+void T_filesystem_proxy::read_entries_info(const T_url& /* directory */,
+                                           T_directory_entries& /* entries */,
+                                           const std::vector<size_t>& /* indices */)
+{
+}
+
+/*****************************************************************************/
+bool T_filesystem_proxy::read_chunks(T_read_fn read_fn,
+                                     size_t chunk_size,
+                                     uint64_t size_hint,
+                                     std::string& data,
+                                     uint64_t max_size)
+{
+  data.clear();
+  data.reserve(std::min(size_hint, max_size));
+
+  for (;;)
+    {
+      uint64_t remaining = max_size - data.size();
+      if (remaining == 0)
+        {
+          // Limit reached: check if the file has more bytes
+          char extra;
+          ssize_t nb_read = read_fn(&extra, 1);
+          if (nb_read < 0)
+            {
+              string errmsg (strerror(errno));
+              throw E_system("Could not read file: " + errmsg);
+            }
+          return (nb_read == 0);
+        }
+
+      size_t offset = data.size();
+      size_t count = std::min<uint64_t>(remaining, chunk_size);
+      data.resize(offset + count);
+      ssize_t nb_read = read_fn(&data[offset], count);
+      if (nb_read < 0)
+        {
+          if (errno == EINTR)
+            {
+              data.resize(offset);
+              continue;
+            }
+          string errmsg (strerror(errno));
+          throw E_system("Could not read file: " + errmsg);
+        }
+      data.resize(offset + nb_read);
+      if (nb_read == 0)
+        {
+          return true;
+        }
+    }
+}
+
 /*****************************************************************************/
 T_filesystem_acl::T_filesystem_acl(T_filesystem_proxy& proxy)
   : _fs(proxy)
@@ -62,23 +261,91 @@ void T_filesystem_acl::add(const string& filepath,
                            const ACL& acl,
                            bool overwrite)
 {
-  super::add(filepath, acl, overwrite);
-
-  if (*filepath.rbegin() != '/')
-    {
-      add(filepath + "/", acl);
-    }
+  _cache.add(filepath, acl, overwrite);
 }
 
 /*****************************************************************************/
 ACL T_filesystem_acl::operator ()(const string& uri)
 {
-  try
+  ACL acl;
+  if (_cache.find(uri, acl))
     {
-      return super::operator()(uri);
+      return acl;
     }
-  LOG_CATCH_AND_DISPLAY("No data in cache for "+uri, WARNING, 9)
-  ACL acl = _fs.read_url_permissions(uri);
+  LOG(INFO, 9) << "No data in cache for " << uri;
+  // Read outside of the cache lock: concurrent misses only cost a duplicate read
+  acl = _fs.read_url_permissions(uri);
   add(uri, acl);
   return acl;
 }
+
+/*****************************************************************************/
+void T_filesystem_acl::directory_done(const string& dirpath,
+                                      uint32_t nb_subdirectories)
+{
+  _cache.directory_done(dirpath, nb_subdirectories);
+}
+
+/*****************************************************************************/
+uint64_t T_filesystem_acl::get_acl_key(const ACL& acl)
+{
+  std::string acl_bytes;
+  acl.SerializeToString(&acl_bytes);
+  uint64_t key = xxhash64(acl_bytes.data(), acl_bytes.size());
+  return (key == 0) ? 1 : key;
+}
+
+/*****************************************************************************/
+uint64_t T_filesystem_acl::get_chain_key(const string& dirpath)
+{
+  uint64_t chain_key;
+  if (_cache.find_chain_key(dirpath, chain_key))
+    {
+      return chain_key;
+    }
+  chain_key = get_acl_key(operator()(dirpath));
+  string parent_path = get_parent_path(dirpath);
+  if (not parent_path.empty())
+    {
+      chain_key = combine_keys(get_chain_key(parent_path), chain_key);
+    }
+  _cache.set_chain_key(dirpath, chain_key);
+  return chain_key;
+}
+
+/*****************************************************************************/
+uint64_t T_filesystem_acl::get_sar_layer(const T_url& url, string& sar_bytes)
+{
+  const string& filepath = url.get_local_path();
+  uint64_t key = get_acl_key(operator()(filepath));
+  if (inherits_ancestors_acls())
+    {
+      string parent_path = get_parent_path(filepath);
+      if (not parent_path.empty())
+        {
+          key = combine_keys(get_chain_key(parent_path), key);
+        }
+    }
+
+  {
+    mutex::scoped_lock lock(_sar_mutex);
+    std::map<uint64_t, string>::const_iterator it = _sar_cache.find(key);
+    if (it != _sar_cache.end())
+      {
+        sar_bytes = it->second;
+        return key;
+      }
+  }
+
+  LOG(INFO, 6) << "Compute SAR for " << filepath;
+  SAR sar = compute_sar_layer(url);
+  sar.SerializeToString(&sar_bytes);
+
+  mutex::scoped_lock lock(_sar_mutex);
+  if (_sar_cache.size() >= max_sar_cache_size)
+    {
+      _sar_cache.clear();
+    }
+  _sar_cache[key] = sar_bytes;
+  return key;
+}
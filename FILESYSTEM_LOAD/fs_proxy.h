@@ -28,6 +28,7 @@ https://github.com/antidot/AIF-Filters/
 #define _FILESYSTEM_PROXY_H
 
 #include "fs_url.h"
+#include "fs_acl_cache.h"
 
 #include <AFS/SECURITY/tools.h>
 #include <COMMON/STR/binstr.h>
@@ -35,7 +36,13 @@ https://github.com/antidot/AIF-Filters/
 #include <COMMON/URI/uri.h>
 #include <COMMON/URI/scheme.pb.h>
 #include <PaF/API/filter.h>
+#include <boost/function.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <vector>
+
+#include <sys/stat.h>
 
 /*****************************************************************************/
 struct T_filesystem_config
@@ -48,6 +55,91 @@ public:
 
 typedef boost::shared_ptr<T_filesystem_config> T_filesystem_config_ptr;
 
+/*****************************************************************************/
+//! @brief Metadata of a file or directory, read with a single stat call
+struct T_file_info
+{
+  enum Type { REGULAR_FILE, DIRECTORY };
+
+  T_file_info(Type file_type = REGULAR_FILE);
+
+  //! @brief Fill all attributes from a stat structure
+  void set(const struct stat& file_stat);
+
+  Type      type;
+  bool      has_attributes; // false if only type is known
+  uint64_t  size;
+  time_t    mtime;
+  time_t    ctime;
+  uint64_t  inode;
+  mode_t    mode;
+};
+
+/*****************************************************************************/
+//! @brief Entries of a directory listing
+//! Names are stored one after another in a single buffer, and handed out as
+//! slices of it: a listing costs a few allocations whatever its size.
+class T_directory_entries
+{
+public:
+  //! @brief Add an entry
+  //! @param name relative to the listed directory
+  //! @param info attributes may be missing, see read_file_info()
+  void add(const char* name, size_t name_length, const T_file_info& info);
+  void add(const std::string& name, const T_file_info& info)
+  { add(name.data(), name.size(), info); }
+
+  //! @brief Reserve room for entries and the total length of their names
+  void reserve(size_t nb_entries, size_t names_length);
+  void clear();
+
+  //! @brief Sort entries by name
+  void sort();
+
+  size_t size() const { return _entries.size(); }
+  bool empty() const { return _entries.empty(); }
+
+  const T_file_info& info(size_t i) const { return _entries[i].info; }
+  T_file_info& info(size_t i) { return _entries[i].info; }
+
+  //! @brief Name of an entry, valid until the next add()
+  const char* name_data(size_t i) const
+  { return _names.data() + _entries[i].name_offset; }
+  size_t name_length(size_t i) const { return _entries[i].name_length; }
+  std::string name(size_t i) const
+  { return std::string(name_data(i), name_length(i)); }
+
+private:
+  struct T_entry
+  {
+    T_entry(size_t offset, size_t length, const T_file_info& entry_info)
+      : name_offset(offset), name_length(length), info(entry_info) {}
+
+    size_t      name_offset;
+    size_t      name_length;
+    T_file_info info;
+  };
+
+  class T_name_less;
+
+  std::string           _names;
+  std::vector<T_entry>  _entries;
+};
+
+/*****************************************************************************/
+//! @brief A file content to read, see read_files_content()
+struct T_content_read
+{
+  T_content_read(const T_url& file_url, const T_file_info& file_info,
+                 std::string& content);
+
+  const T_url*        url;
+  const T_file_info*  info;
+  std::string*        data;     // (out) as for read_file_content()
+  bool                complete; // (out) false if larger than max_size
+  std::string         error;    // (out) not empty if it could not be read
+};
+
 /*****************************************************************************/
 //! @brief An abstract interface for accessing a filesystem to load files
 class T_filesystem_proxy
@@ -66,34 +158,47 @@ public:
   //! path is dependent on filesystem
   //!   - local path (NFS)
   //!   - full url (SAMBA)
-  //! path is what is returned by get_directory_xxx() methods
+  //! path is the listed directory path followed by "/" and the entry name
   virtual T_url_ptr create_url(const std::string& fs_path) const = 0;
 
-  //! @brief Returns true if the provided url is a directory
-  //! @exception E_system if missing execute permission on parent dirs
-  virtual bool check_if_dir_exists(const T_url& url) = 0;
+  //! @brief Creates the URL of an entry of a listed directory
+  //! Filesystems may resolve it from the directory instead of its full path.
+  //! @param directory url given to list_directory()
+  //! @param fs_path as for create_url()
+  virtual T_url_ptr create_entry_url(const T_url& directory,
+                                     const std::string& fs_path) const;
 
   //! @brief Returns true if the provided url is an existing file
   //! @exception E_system if missing execute permission on parent dirs
   virtual bool check_if_file_exists(const T_url& url) = 0;
 
-  //! @brief Retrieve the list of files within a directory
+  //! @brief List the files and subdirectories of a directory in one pass
+  //! Other entries (sockets, devices...) and "." / ".." are skipped.
   //! @param url the url of directory to scan
-  //! @param files (out) URLs of files in the directory
+  //! @param entries (out) entries of the directory, sorted by name, with
+  //! attributes when the listing provides them for free
   //! @exception E_system if permission denied
-  virtual void get_directory_files(const T_url& url,
-                                   std::set<std::string>& files) = 0;
+  virtual void list_directory(const T_url& url,
+                              T_directory_entries& entries) = 0;
 
-  //! @brief Retrieve the list of subdirectories of a directory
-  //! @param url the url of directory to scan
-  //! @param subdirectories (out) URLs of subdirectories
-  //! @exception E_system if permission denied
-  virtual void get_directory_subdirectories(const T_url& url,
-                                            std::set<std::string>& subdirectories) = 0;
+  //! @brief Read the content of a file, in chunks, at most max_size bytes
+  //! @param info file metadata, size is used to allocate data once
+  //! @param data (out) file content, truncated to max_size bytes
+  //! @return false if the file is larger than max_size
+  //! @exception E_system if the file cannot be read
+  virtual bool read_file_content(const T_url& url,
+                                 const T_file_info& info,
+                                 std::string& data,
+                                 uint64_t max_size) = 0;
+
+  //! @brief Number of files read_files_content() reads at once
+  //! 1 if files are read one by one anyway.
+  virtual uint32_t io_batch_size() const { return 1; }
 
-  //! @brief Read the content of a file
-  virtual void read_file_content(const T_url& url,
-                                 N_String::T_binary_string& data) = 0;
+  //! @brief Read the contents of several files, at most max_size bytes each
+  //! Errors are reported in each read, this call does not throw.
+  virtual void read_files_content(std::vector<T_content_read>& reads,
+                                  uint64_t max_size);
 
   //! @brief Read the permissions of a file or directory
   virtual N_Security::ACL read_url_permissions(const T_url& url) = 0;
@@ -101,17 +206,37 @@ public:
   //! @brief Read the permissions of a file or directoty using localpath
   virtual N_Security::ACL read_url_permissions(const string& localpath) = 0;
 
-  //! @brief Retrieve the last modification date of a file/dir
-  virtual time_t read_file_mtime(const T_url& url) = 0;
+  //! @brief Retrieve type, size, dates, inode and mode of a file/dir
+  //! @exception E_system if the file/dir cannot be stat'ed
+  virtual void read_file_info(const T_url& url, T_file_info& info) = 0;
+
+  //! @brief Retrieve the missing attributes of some entries of a directory
+  //! Default does nothing: attributes are then read file by file.
+  //! Entries that cannot be stat'ed are left without attributes.
+  //! @param directory url given to list_directory()
+  //! @param indices of the entries to stat
+  virtual void read_entries_info(const T_url& directory,
+                                 T_directory_entries& entries,
+                                 const std::vector<size_t>& indices);
+
+protected:
+  //! @brief Reads up to count bytes into buffer, returns -1 on error
+  typedef boost::function<ssize_t (char* buffer, size_t count)> T_read_fn;
 
-  //! @brief Retrieve the last permissions change date of a file/dir
-  virtual time_t read_file_ctime(const T_url& url) = 0;
+  //! @brief Read a stream in chunks of chunk_size bytes, see read_file_content
+  //! @exception E_system on read error
+  static bool read_chunks(T_read_fn read_fn,
+                          size_t chunk_size,
+                          uint64_t size_hint,
+                          std::string& data,
+                          uint64_t max_size);
 
 private:
   T_filesystem_config_ptr _config;
 };
 
 /*****************************************************************************/
+//! @brief ACL cache shared by crawl workers (all calls are thread-safe)
 class T_filesystem_acl : public N_Security::T_cache_acl_builder
 {
 public:
@@ -119,7 +244,7 @@ public:
   virtual ~T_filesystem_acl();
 
   //! @brief Add ACL entry into cache
-  //! (actually two entries: one additional with a trailing slash)
+  //! (with or without a trailing slash, the same entry)
   virtual void add(const string& filepath,
                    const N_Security::ACL& acl,
                    bool overwrite = false);
@@ -127,15 +252,35 @@ public:
   //! @brief Compute ACL layer
   virtual N_Security::ACL operator()(const std::string& filepath);
 
+  //! @brief Release the cached ACLs of a processed directory
+  //! @param nb_subdirectories number of its subdirectories still to process
+  void directory_done(const std::string& dirpath, uint32_t nb_subdirectories);
+
   //! @brief Compute SAR layer
   virtual N_Security::SAR compute_sar_layer(const T_url& url) = 0;
 
+  //! @brief Get the serialized SAR layer of a file
+  //! Files with the same chain of ACLs share a SAR, computed only once.
+  //! @param sar_bytes (out) serialized SAR
+  //! @return key of the ACLs the SAR depends on
+  uint64_t get_sar_layer(const T_url& url, std::string& sar_bytes);
+
   //! @brief Log the uuid/guid/sid mapping errors
   virtual void log_mapping_errors(AFS::PaF::Handle& handle) = 0;
 
+protected:
+  //! @brief Returns true if the SAR of a file depends on its ancestors ACLs
+  virtual bool inherits_ancestors_acls() const = 0;
+
 private:
   T_filesystem_proxy& _fs;
-  typedef N_Security::T_cache_acl_builder super;
+  T_acl_cache _cache;
+  boost::mutex _sar_mutex;
+  std::map<uint64_t, std::string> _sar_cache; // serialized SAR by ACLs key
+
+  //! @brief Key of the ACLs of a directory and all its ancestors
+  uint64_t get_chain_key(const std::string& dirpath);
+  static uint64_t get_acl_key(const N_Security::ACL& acl);
 };
 
 #endif // _FILESYSTEM_PROXY_H
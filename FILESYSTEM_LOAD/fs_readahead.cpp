@@ -0,0 +1,276 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Read-ahead of file contents
+ *
+ ***************************************************************************/
+
+#include "fs_readahead.h"
+
+#include <COMMON/BASIC/log.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <algorithm>
+
+using namespace boost;
+
+/*****************************************************************************/
+T_file_read::T_file_read(T_url_ptr file_url,
+                         const T_file_info& file_info,
+                         time_t last_load)
+  : url(file_url),
+    info(file_info),
+    last_load(last_load),
+    content_read(false),
+    complete(false)
+{
+}
+
+/*****************************************************************************/
+T_read_ahead::T_read_ahead(T_filesystem_proxy& fs_proxy,
+                           uint32_t depth,
+                           uint64_t byte_budget,
+                           uint64_t max_size,
+                           bool read_oversized)
+  : _fs_proxy(fs_proxy),
+    _depth(std::max(depth, 1U)),
+    _byte_budget(byte_budget),
+    _max_size(max_size),
+    _read_oversized(read_oversized),
+    _nb_read(0),
+    _nb_taken(0),
+    _bytes_held(0),
+    _reading(false),
+    _reader_busy(false),
+    _stopped(false)
+{
+}
+
+/*****************************************************************************/
+T_read_ahead::~T_read_ahead()
+{
+  if (_reader.get())
+    {
+      {
+        mutex::scoped_lock lock(_mutex);
+        _stopped = true;
+        _changed.notify_all();
+      }
+      _reader->join();
+    }
+}
+
+/*****************************************************************************/
+void T_read_ahead::add(T_url_ptr url, const T_file_info& info, time_t last_load)
+{
+  mutex::scoped_lock lock(_mutex);
+  assert(not _reading && not _reader_busy);
+  _files.push_back(new T_file_read(url, info, last_load));
+  _sizes.push_back(0);
+}
+
+/*****************************************************************************/
+void T_read_ahead::start()
+{
+  mutex::scoped_lock lock(_mutex);
+  _reading = true;
+  _changed.notify_all();
+  if (not _reader.get())
+    {
+      _reader.reset(new thread(bind(&T_read_ahead::reader_loop, this)));
+    }
+}
+
+/*****************************************************************************/
+void T_read_ahead::clear()
+{
+  mutex::scoped_lock lock(_mutex);
+  // Reader stops at its next check, files are released once it does
+  _reading = false;
+  _changed.notify_all();
+  while (_reader_busy)
+    {
+      _changed.wait(lock);
+    }
+  _files.clear();
+  _sizes.clear();
+  _nb_read = 0;
+  _nb_taken = 0;
+  _bytes_held = 0;
+}
+
+/*****************************************************************************/
+T_file_read& T_read_ahead::wait(size_t i)
+{
+  mutex::scoped_lock lock(_mutex);
+  // Release previous files
+  for (; _nb_taken < i; ++_nb_taken)
+    {
+      _bytes_held -= _sizes[_nb_taken];
+      std::string().swap(_files[_nb_taken].data);
+    }
+  _changed.notify_all();
+  while (_nb_read <= i)
+    {
+      _changed.wait(lock);
+    }
+  return _files[i];
+}
+
+/*****************************************************************************/
+uint64_t T_read_ahead::expected_size(const T_file_read& file) const
+{
+  return file.info.has_attributes ? std::min(file.info.size, _max_size) : 0;
+}
+
+/*****************************************************************************/
+void T_read_ahead::reader_loop()
+{
+  for (;;)
+    {
+      {
+        mutex::scoped_lock lock(_mutex);
+        while (not _stopped && not (_reading && _nb_read < _files.size()))
+          {
+            _changed.wait(lock);
+          }
+        if (_stopped)
+          {
+            return;
+          }
+        _reader_busy = true;
+      }
+
+      read_files();
+
+      mutex::scoped_lock lock(_mutex);
+      _reader_busy = false;
+      _changed.notify_all();
+    }
+}
+
+/*****************************************************************************/
+void T_read_ahead::read_files()
+{
+  const size_t batch_size = std::max<uint32_t>(_fs_proxy.io_batch_size(), 1);
+  for (size_t i = 0; i < _files.size(); )
+    {
+      size_t end = i + 1;
+      {
+        mutex::scoped_lock lock(_mutex);
+        // Next file to be taken is always read, whatever its size
+        while (not _stopped && _reading
+               && i > _nb_taken
+               && (i - _nb_taken > _depth
+                   || _bytes_held + expected_size(_files[i]) > _byte_budget))
+          {
+            _changed.wait(lock);
+          }
+        if (_stopped || not _reading)
+          {
+            return;
+          }
+
+        // Following files are read with it if the window allows
+        uint64_t batch_bytes = expected_size(_files[i]);
+        for (; end < _files.size()
+               && end - i < batch_size
+               && end - _nb_taken <= _depth
+               && _bytes_held + batch_bytes + expected_size(_files[end])
+                  <= _byte_budget;
+             ++end)
+          {
+            batch_bytes += expected_size(_files[end]);
+          }
+      }
+
+      read(i, end);
+
+      mutex::scoped_lock lock(_mutex);
+      for (; i < end; ++i)
+        {
+          _sizes[i] = _files[i].data.size();
+          _bytes_held += _sizes[i];
+        }
+      _nb_read = end;
+      _changed.notify_all();
+    }
+}
+
+/*****************************************************************************/
+bool T_read_ahead::is_content_needed(T_file_read& file)
+{
+  try
+    {
+      if (not file.info.has_attributes)
+        {
+          _fs_proxy.read_file_info(*file.url, file.info);
+        }
+    }
+  catch(E_error& e)
+    {
+      // Reported when the file is processed
+      file.error = e.what();
+      return false;
+    }
+  catch(...)
+    {
+      file.error = "unknown error";
+      return false;
+    }
+  if (file.info.mtime <= file.last_load)
+    {
+      return false;
+    }
+  return _read_oversized || file.info.size <= _max_size;
+}
+
+/*****************************************************************************/
+void T_read_ahead::read(size_t begin, size_t end)
+{
+  std::vector<T_content_read> reads;
+  std::vector<size_t> indices;
+  for (size_t i = begin; i < end; ++i)
+    {
+      T_file_read& file = _files[i];
+      if (is_content_needed(file))
+        {
+          file.content_read = true;
+          reads.push_back(T_content_read(*file.url, file.info, file.data));
+          indices.push_back(i);
+        }
+    }
+  if (reads.empty())
+    {
+      return;
+    }
+
+  _fs_proxy.read_files_content(reads, _max_size);
+  for (size_t i = 0; i < reads.size(); ++i)
+    {
+      T_file_read& file = _files[indices[i]];
+      file.complete = reads[i].complete;
+      file.error = reads[i].error;
+    }
+}
@@ -0,0 +1,119 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Read-ahead of file contents
+ *
+ ***************************************************************************/
+#ifndef _FILESYSTEM_READAHEAD_H_
+#define _FILESYSTEM_READAHEAD_H_
+
+#include "fs_proxy.h"
+
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace boost { class thread; }
+
+/*****************************************************************************/
+//! @brief A file read ahead of its processing
+struct T_file_read
+{
+  T_file_read(T_url_ptr file_url, const T_file_info& file_info, time_t last_load);
+
+  T_url_ptr   url;
+  T_file_info info;         // attributes are read if missing
+  time_t      last_load;    // content is read if mtime is newer
+  bool        content_read; // false if the content is not needed
+  bool        complete;     // false if content was truncated to max size
+  std::string data;
+  std::string error;        // not empty if the content could not be read
+};
+
+/*****************************************************************************/
+//! @brief Reads the next files of a list in a background thread
+//! The consumer processes file i while files i+1 to i+depth are read,
+//! within a budget of bytes held in memory. Results are taken in order.
+//! Files are read by batches of the proxy io_batch_size() when the window
+//! allows it.
+//! A list is read between start() and clear(), then the same thread reads
+//! the next list: a crawl worker keeps its reader for all its directories.
+class T_read_ahead
+{
+public:
+  //! @param depth maximum number of files read ahead
+  //! @param byte_budget maximum size of contents held, at least one file
+  //! @param max_size maximum size of a file content
+  //! @param read_oversized if false, files larger than max_size are not read
+  T_read_ahead(T_filesystem_proxy& fs_proxy,
+               uint32_t depth,
+               uint64_t byte_budget,
+               uint64_t max_size,
+               bool read_oversized);
+  //! @brief Stops reading and waits for the background thread
+  ~T_read_ahead();
+
+  //! @brief Add a file to read, before start()
+  void add(T_url_ptr url, const T_file_info& info, time_t last_load);
+
+  //! @brief Start reading the files added in background
+  void start();
+
+  //! @brief Wait for file i, in the order of add() calls
+  //! Previous files are released.
+  T_file_read& wait(size_t i);
+
+  //! @brief Stop reading the files added and release them, so that a new
+  //! list of files can be added
+  void clear();
+
+private:
+  T_filesystem_proxy&             _fs_proxy;
+  uint32_t                        _depth;
+  uint64_t                        _byte_budget;
+  uint64_t                        _max_size;
+  bool                            _read_oversized;
+  boost::ptr_vector<T_file_read>  _files;
+  boost::scoped_ptr<boost::thread> _reader;
+
+  boost::mutex                    _mutex;
+  boost::condition_variable       _changed;
+  size_t                          _nb_read;     // files already read
+  size_t                          _nb_taken;    // files released by consumer
+  uint64_t                        _bytes_held;  // read and not released
+  std::vector<uint64_t>           _sizes;       // bytes held by each file
+  bool                            _reading;     // between start() and clear()
+  bool                            _reader_busy; // reader uses _files
+  bool                            _stopped;
+
+  void reader_loop();
+  //! @brief Read the files added, until they are read or cleared
+  void read_files();
+  uint64_t expected_size(const T_file_read& file) const;
+  //! @brief Read attributes if missing, false if the content is not read
+  bool is_content_needed(T_file_read& file);
+  //! @brief Read files [begin, end), contents in a single batch
+  void read(size_t begin, size_t end);
+};
+
+#endif // _FILESYSTEM_READAHEAD_H_
@@ -32,16 +32,28 @@ https://github.com/antidot/AIF-Filters/
 #include "libsmbclient.h"
 #include <errno.h>
 
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/thread/once.hpp>
+
 using namespace N_Security;
 using namespace boost;
 
 namespace {
-  // Unique Samba configuration for a filter instance
-  // Use Samba client CONTEXT authentication to avoid global variable if needed
-  static T_samba_config_ptr global_conf;
+  static const size_t initial_sec_desc_size = 4096;
+  static const size_t max_sec_desc_size = 1024 * 1024;
+  static const size_t max_sec_desc_cache_size = 65536;
+
+  // libsmbclient locks its global state only once given thread functions
+  static boost::once_flag smbc_threads_once = BOOST_ONCE_INIT;
 
+  // Authentication data is read from the configuration attached to the
+  // context: no process-global state
   static void
-  get_auth_data_fn(const char * pServer,
+  get_auth_data_fn(SMBCCTX * ctx,
+                  const char * pServer,
                   const char * pShare,
                   char * pWorkgroup,
                   int maxLenWorkgroup,
@@ -50,11 +62,13 @@ namespace {
                   char * pPassword,
                   int maxLenPassword)
   {
-      const char *server = global_conf->remote_host.c_str();
-      const char *share = global_conf->share_name.c_str();
-      const char *username = global_conf->user.c_str();
-      const char *password = global_conf->password.c_str();
-      const char *workgroup = global_conf->workgroup.c_str();
+      const T_samba_config* conf
+        = static_cast<const T_samba_config*>(smbc_getOptionUserData(ctx));
+      const char *server = conf->remote_host.c_str();
+      const char *share = conf->share_name.c_str();
+      const char *username = conf->user.c_str();
+      const char *password = conf->password.c_str();
+      const char *workgroup = conf->workgroup.c_str();
 
       LOG(INFO, 8) << "Checking SAMBA authentication: " << pServer << "/" << pShare;
       if (strcmp(server, pServer) == 0 &&
@@ -72,7 +86,8 @@ namespace {
 
 T_samba_filesystem::T_samba_filesystem(T_filesystem_config_ptr conf)
   : T_filesystem_proxy(conf),
-    _config(dynamic_pointer_cast<T_samba_config>(conf))
+    _config(dynamic_pointer_cast<T_samba_config>(conf)),
+    _sid_mappings(_config->sid_mapping)
 {
   assert(_config.get());
   if (_config->share_name.empty()
@@ -80,11 +95,15 @@ T_samba_filesystem::T_samba_filesystem(T_filesystem_config_ptr conf)
     {
       LOG(ERROR, 1) << "Invalid Samba configuration";
     }
-  global_conf = _config;
 }
 
 T_samba_filesystem::~T_samba_filesystem()
 {
+  disconnect();
+  if (not _contexts.empty())
+    {
+      LOG(ERROR, 1) << "Samba context(s) still in use: " << _contexts.size();
+    }
 }
 
 T_samba_config_ptr
@@ -95,19 +114,96 @@ T_samba_filesystem::get_config() const
 
 void T_samba_filesystem::connect()
 {
-  int err = smbc_init(get_auth_data_fn,  1);
+  // Check configuration with a first context, kept in the pool
+  release_context(acquire_context());
+}
 
-  if (err < 0)
+void T_samba_filesystem::disconnect()
+{
+  // May be called several times: contexts still in use are kept, and freed
+  // by the next call once released
+  mutex::scoped_lock lock(_contexts_mutex);
+  BOOST_FOREACH(SMBCCTX* ctx, _free_contexts)
     {
-      throw E_system("Cannot initialize Samba");
+      smbc_free_context(ctx, 1);
+      _contexts.erase(std::find(_contexts.begin(), _contexts.end(), ctx));
     }
+  _free_contexts.clear();
 }
 
-void T_samba_filesystem::disconnect()
+map<string, uint32_t>
+T_samba_filesystem::sid_misses() const
+{
+  map<string, uint32_t> misses;
+  BOOST_FOREACH(const T_sid_mapping& shard, _sid_mappings.all())
+    {
+      typedef map<string, uint32_t>::value_type T_miss;
+      BOOST_FOREACH(const T_miss& miss, shard.get_misses())
+        {
+          misses[miss.first] += miss.second;
+        }
+    }
+  return misses;
+}
+
+/*****************************************************************************/
+SMBCCTX* T_samba_filesystem::create_context()
 {
-  // nothing to do
+  boost::call_once(smbc_threads_once, smbc_thread_posix);
+  SMBCCTX* ctx = smbc_new_context();
+  if (ctx == NULL)
+    {
+      string errmsg (strerror(errno));
+      throw E_system("Cannot initialize Samba: " + errmsg);
+    }
+  smbc_setOptionUserData(ctx, _config.get());
+  smbc_setFunctionAuthDataWithContext(ctx, get_auth_data_fn);
+  if (smbc_init_context(ctx) == NULL)
+    {
+      string errmsg (strerror(errno));
+      smbc_free_context(ctx, 0);
+      throw E_system("Cannot initialize Samba: " + errmsg);
+    }
+  return ctx;
 }
 
+SMBCCTX* T_samba_filesystem::acquire_context()
+{
+  {
+    mutex::scoped_lock lock(_contexts_mutex);
+    if (not _free_contexts.empty())
+      {
+        SMBCCTX* ctx = _free_contexts.back();
+        _free_contexts.pop_back();
+        return ctx;
+      }
+  }
+
+  // Pool grows up to the number of concurrent callers
+  SMBCCTX* ctx = create_context();
+  mutex::scoped_lock lock(_contexts_mutex);
+  _contexts.push_back(ctx);
+  LOG(INFO, 5) << "Samba context pool size: " << _contexts.size();
+  return ctx;
+}
+
+void T_samba_filesystem::release_context(SMBCCTX* ctx)
+{
+  mutex::scoped_lock lock(_contexts_mutex);
+  _free_contexts.push_back(ctx);
+}
+
+T_samba_filesystem::T_context::T_context(T_samba_filesystem& samba_fs)
+  : _samba_fs(samba_fs), _ctx(samba_fs.acquire_context())
+{
+}
+
+T_samba_filesystem::T_context::~T_context()
+{
+  _samba_fs.release_context(_ctx);
+}
+
+/*****************************************************************************/
 T_url_ptr T_samba_filesystem::create_url(const N_Uri::T_uri& uri) const
 {
   return T_url_ptr(new T_samba_url(uri));
@@ -118,25 +214,11 @@ T_url_ptr T_samba_filesystem::create_url(const std::string& fs_path) const
   return T_url_ptr(new T_samba_url(fs_path));
 }
 
-bool T_samba_filesystem::check_if_dir_exists(const T_url& url)
-{
-  if (smbc_opendir(url.get_local_path().c_str()) < 0)
-    {
-      string errmsg (strerror(errno));
-      LOG(INFO, 5) << "Internal samba error: " << errmsg;
-      if ((errno == ENOENT) || (errno == ENOTDIR))
-        {
-          return false;
-        }
-      throw E_system("Could not check directory: " + errmsg);
-    }
-  return true;
-}
-
 bool T_samba_filesystem::check_if_file_exists(const T_url& url)
 {
+  T_context ctx(*this);
   struct stat file_info;
-  if (smbc_stat(url.get_local_path().c_str(), &file_info) == 0)
+  if (smbc_getFunctionStat(ctx)(ctx, url.get_local_path().c_str(), &file_info) == 0)
     {
       bool res = S_ISREG(file_info.st_mode) ;
       return res;
@@ -147,98 +229,72 @@ bool T_samba_filesystem::check_if_file_exists(const T_url& url)
 }
 
 void
-T_samba_filesystem::get_directory_files(const T_url& url,
-                                        set< std::string >& files)
+T_samba_filesystem::list_directory(const T_url& url,
+                                   T_directory_entries& entries)
 {
-  int dir_handle = smbc_opendir(url.get_local_path().c_str());
-  if (dir_handle < 1)
+  T_context ctx(*this);
+  SMBCFILE* dir_handle = smbc_getFunctionOpendir(ctx)(ctx, url.get_local_path().c_str());
+  if (dir_handle == NULL)
     {
       string errmsg (strerror(errno));
       throw E_system("Could not open directory: " + errmsg);
     }
 
+  smbc_readdir_fn readdir_fn = smbc_getFunctionReaddir(ctx);
   struct smbc_dirent * entry;
 
-  while ((entry = smbc_readdir(dir_handle)) != NULL)
+  while ((entry = readdir_fn(ctx, dir_handle)) != NULL)
     {
       uint32_t entry_type = entry->smbc_type;
+      const char* name = entry->name;
       if (entry_type == SMBC_FILE)
         {
-          string entry_name(entry->name);
-          string entry_url(url.get_local_path() + "/"+ entry_name);
-          files.insert(entry_url);
+          entries.add(name, strlen(name), T_file_info::REGULAR_FILE);
         }
-    }
-}
-
-void
-T_samba_filesystem::get_directory_subdirectories(const T_url& url,
-                                                 set< std::string >& subdirectories)
-{
-  int dir_handle = smbc_opendir(url.get_local_path().c_str());
-  if (dir_handle < 1)
-    {
-      string errmsg (strerror(errno));
-      throw E_system("Could not open directory: " + errmsg);
-    }
-
-  struct smbc_dirent * entry;
-
-  while ((entry = smbc_readdir(dir_handle)) != NULL)
-    {
-      uint32_t entry_type = entry->smbc_type;
-      if (entry_type == SMBC_DIR)
+      else if ((entry_type == SMBC_DIR)
+               && (strcmp(name, ".") != 0) && (strcmp(name, "..") != 0))
         {
-          string entry_name(entry->name);
-          if ((entry_name != ".") && (entry_name != ".."))
-            {
-              string entry_url(url.get_local_path() + "/"+ entry_name);
-              subdirectories.insert(entry_url);
-            }
+          entries.add(name, strlen(name), T_file_info::DIRECTORY);
         }
     }
 
-  smbc_closedir(dir_handle);
+  smbc_getFunctionClosedir(ctx)(ctx, dir_handle);
+
+  entries.sort();
 }
 
-void
+bool
 T_samba_filesystem::read_file_content(const T_url& url,
-                                      T_binary_string& data)
+                                      const T_file_info& info,
+                                      string& data,
+                                      uint64_t max_size)
 {
-  int fd = smbc_open(url.get_local_path().c_str(), O_RDONLY, 0666);
-  if (fd < 0)
+  T_context ctx(*this);
+  SMBCFILE* file = smbc_getFunctionOpen(ctx)(ctx, url.get_local_path().c_str(),
+                                             O_RDONLY, 0666);
+  if (file == NULL)
     {
       string errmsg (strerror(errno));
       throw E_system("Could not open file: " + errmsg);
     }
 
-  struct stat file_info;
-  int err = smbc_fstat(fd, &file_info);
-  if (err < 0)
+  try
     {
-      smbc_close(fd);
-      string errmsg (strerror(errno));
-      throw E_system("Could not stat file: " + errmsg);
+      // libsmbclient splits each read into several SMB read requests
+      // kept in flight together: large blocks hide the network latency
+      bool complete = read_chunks(boost::bind(smbc_getFunctionRead(ctx),
+                                              static_cast<SMBCCTX*>(ctx),
+                                              file, _1, _2),
+                                  _config->read_block_size,
+                                  info.size, data, max_size);
+      smbc_getFunctionClose(ctx)(ctx, file);
+      return complete;
     }
-
-  size_t contents_len = file_info.st_size;
-  char *contents = new char[contents_len];
-  T_auto_delete_char dcontents(contents);
-  size_t nb_read = smbc_read(fd, contents, contents_len);
-
-  if (nb_read != contents_len)
+  catch (...)
     {
-      stringstream msg_s;
-      msg_s << "Short read: read only " << nb_read << " bytes ("
-            << contents_len << " expected)" << endl;
-      smbc_close(fd);
-      throw E_system(msg_s);
+      smbc_getFunctionClose(ctx)(ctx, file);
+      throw;
     }
-
-  N_String::T_binary_string contents_s(contents, contents_len);
-  data.swap(contents_s);
-
-  smbc_close(fd);
 }
 
 N_Security::ACL
@@ -250,48 +306,60 @@ T_samba_filesystem::read_url_permissions(const T_url& url)
 N_Security::ACL
 T_samba_filesystem::read_url_permissions(const std::string& localpath)
 {
-  N_Security::ACL acl;
   static const char* attr_name = "system.nt_sec_desc.*";
 
-  size_t contents_len(1024);
-  char *contents = new char[contents_len];
-  T_auto_delete_char dcontents(contents);
-
   LOG(INFO, 3) << "Reading permissions for: " << localpath;
 
-  if (smbc_getxattr(localpath.c_str(), attr_name, contents, contents_len) < 0)
-    {
-      string errmsg (strerror(errno));
-      throw E_system("Could not get ACL: " + errmsg);
-    }
+  // Buffer grows until the whole descriptor fits
+  std::vector<char> contents(initial_sec_desc_size);
+  {
+    T_context ctx(*this);
+    smbc_getxattr_fn getxattr_fn = smbc_getFunctionGetxattr(ctx);
+    while (getxattr_fn(ctx, localpath.c_str(), attr_name,
+                       &contents[0], contents.size()) < 0)
+      {
+        if (errno != ERANGE || contents.size() >= max_sec_desc_size)
+          {
+            string errmsg (strerror(errno));
+            throw E_system("Could not get ACL: " + errmsg);
+          }
+        contents.assign(contents.size() * 2, '\0');
+      }
+  }
+  string sec_desc(&contents[0], strnlen(&contents[0], contents.size()));
 
-  return build_acl_from_nt_sec_desc(contents, _config->sid_mapping);
-}
+  // Files share a few distinct descriptors: each is parsed and mapped once
+  {
+    mutex::scoped_lock lock(_sec_desc_cache_mutex);
+    T_sec_desc_cache::const_iterator it = _sec_desc_cache.find(sec_desc);
+    if (it != _sec_desc_cache.end())
+      {
+        return it->second;
+      }
+  }
+  ACL acl = build_acl_from_nt_sec_desc(sec_desc.c_str(), _sid_mappings.local());
 
-time_t
-T_samba_filesystem::read_file_mtime(const T_url& url)
-{
-  struct stat file_info;
-  int err = smbc_stat(url.get_local_path().c_str(), &file_info);
-  if (err < 0)
+  mutex::scoped_lock lock(_sec_desc_cache_mutex);
+  if (_sec_desc_cache.size() >= max_sec_desc_cache_size)
     {
-      string errmsg (strerror(errno));
-      throw E_system("Could not stat file: " + errmsg);
+      _sec_desc_cache.clear();
     }
-  return file_info.st_mtime;
+  _sec_desc_cache[sec_desc] = acl;
+  return acl;
 }
 
-time_t
-T_samba_filesystem::read_file_ctime(const T_url& url)
+void
+T_samba_filesystem::read_file_info(const T_url& url, T_file_info& info)
 {
+  T_context ctx(*this);
   struct stat file_info;
-  int err = smbc_stat(url.get_local_path().c_str(), &file_info);
+  int err = smbc_getFunctionStat(ctx)(ctx, url.get_local_path().c_str(), &file_info);
   if (err < 0)
     {
       string errmsg (strerror(errno));
       throw E_system("Could not stat file: " + errmsg);
     }
-  return file_info.st_ctime;
+  info.set(file_info);
 }
 
 /*****************************************************************************/
@@ -300,6 +368,11 @@ T_samba_acl::T_samba_acl(T_samba_filesystem& samba_fs)
 {
 }
 
+T_samba_acl::T_samba_acl(T_samba_filesystem& samba_fs, T_filesystem_proxy& reader)
+  : T_filesystem_acl(reader), _samba_fs(samba_fs)
+{
+}
+
 T_samba_acl::~T_samba_acl()
 {
 }
@@ -313,8 +386,7 @@ T_samba_acl::compute_sar_layer(const T_url& url)
 void
 T_samba_acl::log_mapping_errors(AFS::PaF::Handle& handle)
 {
-  const map< string, uint32_t >&  errors
-    = _samba_fs.get_config()->sid_mapping.get_misses();
+  const map< string, uint32_t > errors = _samba_fs.sid_misses();
   if (not errors.empty())
     {
       ostringstream msg;
@@ -336,6 +408,12 @@ T_samba_acl::log_mapping_errors(AFS::PaF::Handle& handle)
     }
 }
 
+/*****************************************************************************/
+T_samba_config::T_samba_config()
+  : read_block_size(4 * 1024 * 1024)
+{
+}
+
 /*****************************************************************************/
 void
 T_samba_config::add_sid_mappings(const map<string,string >& sid_map,
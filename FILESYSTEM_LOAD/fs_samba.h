@@ -27,16 +27,25 @@ https://github.com/antidot/AIF-Filters/
 #define _SAMBA_FILESYSTEM_H
 
 #include "fs_proxy.h"
+#include "fs_shards.h"
 #include <AFS/SECURITY/win_acl.h>
 
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+
+typedef struct _SMBCCTX SMBCCTX;
+
 
 /*****************************************************************************/
 struct T_samba_config : public T_filesystem_config {
+  T_samba_config();
+
   std::string user;
   std::string password;
   std::string workgroup;
   std::string share_name;
   N_Security::T_sid_mapping sid_mapping;
+  size_t read_block_size; // bytes requested by each smbc_read call
   void add_sid_mappings(const std::map<std::string, std::string>& ,
                         N_Security::ActorType actor_type);
 };
@@ -44,6 +53,9 @@ struct T_samba_config : public T_filesystem_config {
 typedef boost::shared_ptr<T_samba_config> T_samba_config_ptr;
 
 /*****************************************************************************/
+//! @brief Samba filesystem proxy, safe for concurrent use
+//! Each call borrows a libsmbclient context (connection and credentials)
+//! from a pool, so that concurrent calls use distinct connections.
 class T_samba_filesystem : public T_filesystem_proxy
 {
 public:
@@ -52,26 +64,57 @@ public:
 
   T_samba_config_ptr get_config() const;
 
+  //! @brief SID mapping misses of all threads, once the crawl is over
+  std::map<std::string, uint32_t> sid_misses() const;
+
   virtual void connect();
   virtual void disconnect();
 
   virtual T_url_ptr create_url(const N_Uri::T_uri& uri) const;
   virtual T_url_ptr create_url(const std::string& fs_path) const;
-  virtual bool check_if_dir_exists(const T_url& url);
   virtual bool check_if_file_exists(const T_url& url);
-  virtual void get_directory_files(const T_url& url,
-                                   std::set<std::string>& files);
-  virtual void get_directory_subdirectories(const T_url& url,
-                                            std::set<std::string>& subdirectories);
-  virtual void read_file_content(const T_url& url,
-                                 N_String::T_binary_string& data);
+  virtual void list_directory(const T_url& url,
+                              T_directory_entries& entries);
+  virtual bool read_file_content(const T_url& url,
+                                 const T_file_info& info,
+                                 std::string& data,
+                                 uint64_t max_size);
   virtual N_Security::ACL read_url_permissions(const T_url& url);
   virtual N_Security::ACL read_url_permissions(const string& localpath) ;
-  virtual time_t read_file_mtime(const T_url& url);
-  virtual time_t read_file_ctime(const T_url& url);
+  virtual void read_file_info(const T_url& url, T_file_info& info);
 
 private:
   T_samba_config_ptr _config;
+
+  boost::mutex           _contexts_mutex;
+  std::vector<SMBCCTX*>  _contexts;      // all created contexts
+  std::vector<SMBCCTX*>  _free_contexts; // contexts not in use
+
+  // SID mapping is read-only after init, misses are counted by each thread
+  T_thread_shards<N_Security::T_sid_mapping> _sid_mappings;
+
+  // ACLs by raw security descriptor
+  typedef boost::unordered_map<std::string, N_Security::ACL> T_sec_desc_cache;
+  boost::mutex           _sec_desc_cache_mutex;
+  T_sec_desc_cache       _sec_desc_cache;
+
+  //! @brief Borrows a context from the pool for the current scope
+  class T_context
+  {
+  public:
+    T_context(T_samba_filesystem& samba_fs);
+    ~T_context();
+    operator SMBCCTX*() const { return _ctx; }
+  private:
+    T_samba_filesystem& _samba_fs;
+    SMBCCTX*            _ctx;
+  };
+
+  //! @brief Creates and initializes a new context
+  //! @exception E_system if libsmbclient cannot be initialized
+  SMBCCTX* create_context();
+  SMBCCTX* acquire_context();
+  void release_context(SMBCCTX* ctx);
 };
 
 /*****************************************************************************/
@@ -79,6 +122,8 @@ class T_samba_acl : public T_filesystem_acl
 {
   public:
     T_samba_acl(T_samba_filesystem&);
+    //! @param reader proxy permissions are read through (eg instrumented)
+    T_samba_acl(T_samba_filesystem&, T_filesystem_proxy& reader);
     virtual ~T_samba_acl();
 
     //! @brief Compute SAR layer
@@ -87,6 +132,10 @@ class T_samba_acl : public T_filesystem_acl
     //! @brief Log the sid mapping errors
     virtual void log_mapping_errors(AFS::PaF::Handle& handle);
 
+  protected:
+    //! @brief NT ACLs already include inherited entries
+    virtual bool inherits_ancestors_acls() const { return false; }
+
   private:
     typedef N_Security::T_cache_acl_builder super;
     T_samba_filesystem& _samba_fs;
@@ -0,0 +1,115 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Per-thread instances merged at shutdown
+ *
+ ***************************************************************************/
+#ifndef _FILESYSTEM_SHARDS_H_
+#define _FILESYSTEM_SHARDS_H_
+
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <vector>
+
+/*****************************************************************************/
+//! @brief One copy of a prototype per thread, without locking after creation
+//! Used for the statistics updated by non thread-safe library calls: each
+//! thread updates its own shard, and shards are kept after their thread ends
+//! so that they can be merged.
+//! The shard of a finished thread is reused by the next new thread, so there
+//! are only as many copies as threads running at the same time, even if a
+//! pool of workers is started for each crawled root.
+template <class T>
+class T_thread_shards
+{
+public:
+  T_thread_shards(const T& prototype)
+    : _pool(new T_pool(prototype)), _local(&T_thread_shards::release) {}
+
+  //! @brief The shard of the calling thread
+  T& local()
+  {
+    T_lease* lease = _local.get();
+    if (lease == NULL)
+      {
+        lease = new T_lease(_pool);
+        _local.reset(lease);
+      }
+    return *lease->shard;
+  }
+
+  //! @brief All the shards, only when no thread updates them
+  const boost::ptr_vector<T>& all() const { return _pool->shards; }
+
+private:
+  // Shards, shared with the threads which may end after this object
+  struct T_pool
+  {
+    T_pool(const T& prototype_) : prototype(prototype_) {}
+
+    T                     prototype;
+    boost::mutex          mutex;
+    boost::ptr_vector<T>  shards;
+    std::vector<T*>       free_shards;  // shards of finished threads
+  };
+
+  // Shard used by a thread until it ends
+  struct T_lease
+  {
+    T_lease(const boost::shared_ptr<T_pool>& pool_)
+      : pool(pool_)
+    {
+      boost::mutex::scoped_lock lock(pool->mutex);
+      if (pool->free_shards.empty())
+        {
+          pool->shards.push_back(new T(pool->prototype));
+          shard = &pool->shards.back();
+        }
+      else
+        {
+          shard = pool->free_shards.back();
+          pool->free_shards.pop_back();
+        }
+    }
+
+    boost::shared_ptr<T_pool> pool;
+    T*                        shard;
+  };
+
+  boost::shared_ptr<T_pool>             _pool;
+  boost::thread_specific_ptr<T_lease>   _local;
+
+  // Called when a thread ends: its shard is kept for the next thread
+  static void release(T_lease* lease)
+  {
+    {
+      boost::mutex::scoped_lock lock(lease->pool->mutex);
+      lease->pool->free_shards.push_back(lease->shard);
+    }
+    delete lease;
+  }
+};
+
+#endif // _FILESYSTEM_SHARDS_H_
@@ -0,0 +1,402 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Persistent index of crawled files state
+ *
+ ***************************************************************************/
+
+#include "fs_state.h"
+#include "fs_manifest.h"
+
+#include <COMMON/BASIC/log.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+
+using namespace boost;
+
+namespace {
+  static const char index_magic[8] = { 'A', 'F', 'S', 'F', 'S', 'I', 'D', 'X' };
+  static const uint32_t index_version = 4;
+  static const uint64_t initial_capacity = 1 << 16;
+
+  inline std::string system_error(const std::string& msg, const std::string& filepath)
+  {
+    return msg + ": " + filepath + ": " + strerror(errno);
+  }
+} // namespace
+
+/*****************************************************************************/
+T_crawl_state_index::T_crawl_state_index(const std::string& filepath)
+  : _filepath(filepath),
+    _fd(-1),
+    _mapped_size(0),
+    _header(NULL),
+    _slots(NULL)
+{
+  int fd = open(filepath.c_str(), O_RDWR);
+  if (fd >= 0)
+    {
+      struct stat file_stat;
+      if (fstat(fd, &file_stat) == 0
+          && static_cast<size_t>(file_stat.st_size) >= sizeof(T_header))
+        {
+          void* addr = mmap(NULL, file_stat.st_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, fd, 0);
+          if (addr != MAP_FAILED)
+            {
+              T_header* header = static_cast<T_header*>(addr);
+              if (memcmp(header->magic, index_magic, sizeof(index_magic)) == 0
+                  && header->version == index_version
+                  && header->slot_size == sizeof(T_slot)
+                  && file_stat.st_size == static_cast<off_t>(sizeof(T_header)
+                                            + header->capacity * sizeof(T_slot)))
+                {
+                  _fd = fd;
+                  _mapped_size = file_stat.st_size;
+                  _header = header;
+                  _slots = reinterpret_cast<T_slot*>(header + 1);
+                  LOG(INFO, 4) << "Crawl state index loaded: " << filepath
+                               << " (" << _header->count << " files)";
+                  return;
+                }
+              munmap(addr, file_stat.st_size);
+            }
+        }
+      close(fd);
+      LOG(WARNING, 2) << "Invalid crawl state index, recreated: " << filepath;
+    }
+
+  create(filepath, initial_capacity, _fd, _mapped_size, _header);
+  _slots = reinterpret_cast<T_slot*>(_header + 1);
+}
+
+/*****************************************************************************/
+T_crawl_state_index::~T_crawl_state_index()
+{
+  unmap();
+}
+
+/*****************************************************************************/
+void T_crawl_state_index::create(const std::string& filepath,
+                                 uint64_t capacity,
+                                 int& fd,
+                                 size_t& mapped_size,
+                                 T_header*& header)
+{
+  fd = open(filepath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    {
+      throw E_system(system_error("Could not create crawl state index", filepath));
+    }
+  mapped_size = sizeof(T_header) + capacity * sizeof(T_slot);
+  if (ftruncate(fd, mapped_size) < 0)
+    {
+      close(fd);
+      throw E_system(system_error("Could not resize crawl state index", filepath));
+    }
+  void* addr = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED)
+    {
+      close(fd);
+      throw E_system(system_error("Could not map crawl state index", filepath));
+    }
+
+  // File is zero-filled by ftruncate: all slots are empty
+  header = static_cast<T_header*>(addr);
+  memcpy(header->magic, index_magic, sizeof(index_magic));
+  header->version = index_version;
+  header->slot_size = sizeof(T_slot);
+  header->capacity = capacity;
+  header->count = 0;
+}
+
+/*****************************************************************************/
+void T_crawl_state_index::unmap()
+{
+  if (_header != NULL)
+    {
+      msync(_header, _mapped_size, MS_SYNC);
+      munmap(_header, _mapped_size);
+      _header = NULL;
+      _slots = NULL;
+    }
+  if (_fd >= 0)
+    {
+      close(_fd);
+      _fd = -1;
+    }
+}
+
+/*****************************************************************************/
+uint64_t T_crawl_state_index::key(const std::string& uri)
+{
+  uint64_t fingerprint = T_crawl_manifest::fingerprint(uri);
+  return (fingerprint == 0) ? 1 : fingerprint;
+}
+
+/*****************************************************************************/
+T_crawl_state_index::T_slot* T_crawl_state_index::find(uint64_t key) const
+{
+  uint64_t mask = _header->capacity - 1;
+  for (uint64_t i = key & mask; ; i = (i + 1) & mask)
+    {
+      if (_slots[i].key == key)
+        {
+          return &_slots[i];
+        }
+      if (_slots[i].key == 0)
+        {
+          return NULL;
+        }
+    }
+}
+
+/*****************************************************************************/
+T_crawl_state_index::T_slot* T_crawl_state_index::insert(uint64_t key)
+{
+  uint64_t mask = _header->capacity - 1;
+  for (uint64_t i = key & mask; ; i = (i + 1) & mask)
+    {
+      if (_slots[i].key == key)
+        {
+          return &_slots[i];
+        }
+      if (_slots[i].key == 0)
+        {
+          _slots[i].key = key;
+          ++_header->count;
+          return &_slots[i];
+        }
+    }
+}
+
+/*****************************************************************************/
+T_crawl_state_index::T_slot* T_crawl_state_index::insert_or_grow(uint64_t key)
+{
+  // Keep load factor under 3/4
+  if ((_header->count + 1) * 4 > _header->capacity * 3)
+    {
+      grow();
+    }
+  return insert(key);
+}
+
+/*****************************************************************************/
+void T_crawl_state_index::grow()
+{
+  // Rehash into a new file, then replace the current one
+  std::string new_filepath = _filepath + ".tmp";
+  int new_fd;
+  size_t new_mapped_size;
+  T_header* new_header;
+  create(new_filepath, _header->capacity * 2, new_fd, new_mapped_size, new_header);
+  T_slot* new_slots = reinterpret_cast<T_slot*>(new_header + 1);
+
+  uint64_t new_mask = new_header->capacity - 1;
+  for (uint64_t i = 0; i < _header->capacity; ++i)
+    {
+      if (_slots[i].key != 0)
+        {
+          uint64_t j = _slots[i].key & new_mask;
+          while (new_slots[j].key != 0)
+            {
+              j = (j + 1) & new_mask;
+            }
+          new_slots[j] = _slots[i];
+          ++new_header->count;
+        }
+    }
+
+  if (rename(new_filepath.c_str(), _filepath.c_str()) < 0)
+    {
+      munmap(new_header, new_mapped_size);
+      close(new_fd);
+      throw E_system(system_error("Could not replace crawl state index", _filepath));
+    }
+  unmap();
+  _fd = new_fd;
+  _mapped_size = new_mapped_size;
+  _header = new_header;
+  _slots = new_slots;
+  LOG(INFO, 5) << "Crawl state index capacity: " << _header->capacity;
+}
+
+/*****************************************************************************/
+bool T_crawl_state_index::is_unchanged(const std::string& uri,
+                                       const T_file_info& info) const
+{
+  mutex::scoped_lock lock(_mutex);
+  const T_slot* slot = find(key(uri));
+  return (slot != NULL
+          && slot->outcome == LOADED_OK
+          && slot->mtime == info.mtime
+          && slot->ctime == info.ctime
+          && slot->size == info.size);
+}
+
+/*****************************************************************************/
+void T_crawl_state_index::update(const std::string& uri,
+                                 const T_file_info& info,
+                                 Outcome outcome)
+{
+  uint64_t uri_key = key(uri);
+  mutex::scoped_lock lock(_mutex);
+  T_slot& slot = _staged[uri_key];
+  slot.key = uri_key;
+  slot.mtime = info.mtime;
+  slot.ctime = info.ctime;
+  slot.size = info.size;
+  slot.outcome = outcome;
+}
+
+/*****************************************************************************/
+void T_crawl_state_index::discard(const std::string& uri)
+{
+  uint64_t uri_key = key(uri);
+  mutex::scoped_lock lock(_mutex);
+  _staged.erase(uri_key);
+}
+
+/*****************************************************************************/
+void T_crawl_state_index::commit()
+{
+  mutex::scoped_lock lock(_mutex);
+  for (T_staged_slots::const_iterator it = _staged.begin();
+       it != _staged.end(); ++it)
+    {
+      const T_slot& staged = it->second;
+      T_slot* slot = insert_or_grow(staged.key);
+      if (staged.outcome != UNKNOWN)
+        {
+          slot->mtime = staged.mtime;
+          slot->ctime = staged.ctime;
+          slot->size = staged.size;
+          slot->outcome = staged.outcome;
+        }
+      if (staged.digest != 0)
+        {
+          slot->digest = staged.digest;
+          slot->digest_mtime = staged.digest_mtime;
+        }
+      if (staged.sar_key != 0)
+        {
+          slot->sar_key = staged.sar_key;
+        }
+    }
+  LOG(INFO, 4) << "Crawl state index: " << _staged.size()
+               << " file(s) updated";
+  T_staged_slots().swap(_staged);
+  msync(_header, _mapped_size, MS_ASYNC);
+}
+
+/*****************************************************************************/
+bool T_crawl_state_index::get_digest(const std::string& uri,
+                                     uint64_t& digest,
+                                     time_t& mtime) const
+{
+  mutex::scoped_lock lock(_mutex);
+  const T_slot* slot = find(key(uri));
+  if (slot == NULL || slot->digest == 0)
+    {
+      return false;
+    }
+  digest = slot->digest;
+  mtime = slot->digest_mtime;
+  return true;
+}
+
+/*****************************************************************************/
+void T_crawl_state_index::set_digest(const std::string& uri,
+                                     uint64_t digest,
+                                     time_t mtime)
+{
+  uint64_t uri_key = key(uri);
+  mutex::scoped_lock lock(_mutex);
+  T_slot& slot = _staged[uri_key];
+  slot.key = uri_key;
+  slot.digest = digest;
+  slot.digest_mtime = mtime;
+}
+
+/*****************************************************************************/
+bool T_crawl_state_index::get_sar_key(const std::string& uri,
+                                      uint64_t& sar_key) const
+{
+  mutex::scoped_lock lock(_mutex);
+  const T_slot* slot = find(key(uri));
+  if (slot == NULL || slot->sar_key == 0)
+    {
+      return false;
+    }
+  sar_key = slot->sar_key;
+  return true;
+}
+
+/*****************************************************************************/
+void T_crawl_state_index::set_sar_key(const std::string& uri, uint64_t sar_key)
+{
+  uint64_t uri_key = key(uri);
+  mutex::scoped_lock lock(_mutex);
+  T_slot& slot = _staged[uri_key];
+  slot.key = uri_key;
+  slot.sar_key = sar_key;
+}
+
+/*****************************************************************************/
+void T_crawl_state_index::remove(const std::string& uri)
+{
+  mutex::scoped_lock lock(_mutex);
+  _staged.erase(key(uri));
+  T_slot* slot = find(key(uri));
+  if (slot == NULL)
+    {
+      return;
+    }
+
+  // Linear probing deletion: shift back the following entries of the cluster
+  uint64_t mask = _header->capacity - 1;
+  uint64_t i = slot - _slots;
+  for (uint64_t j = (i + 1) & mask; _slots[j].key != 0; j = (j + 1) & mask)
+    {
+      uint64_t home = _slots[j].key & mask;
+      bool movable = (i <= j) ? (home <= i || home > j)
+                              : (home <= i && home > j);
+      if (movable)
+        {
+          _slots[i] = _slots[j];
+          i = j;
+        }
+    }
+  memset(&_slots[i], 0, sizeof(T_slot));
+  --_header->count;
+}
+
+/*****************************************************************************/
+uint64_t T_crawl_state_index::size() const
+{
+  mutex::scoped_lock lock(_mutex);
+  return _header->count;
+}
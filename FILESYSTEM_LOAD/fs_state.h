@@ -0,0 +1,132 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Persistent index of crawled files state
+ *
+ ***************************************************************************/
+#ifndef _FILESYSTEM_STATE_H_
+#define _FILESYSTEM_STATE_H_
+
+#include "fs_proxy.h"
+
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+
+/*****************************************************************************/
+//! @brief On-disk index of the files loaded by previous runs
+//! A memory-mapped open addressing hash table keyed by the 64-bit fingerprint
+//! of the document URI, storing the attributes seen when the file was loaded
+//! and the keys of its contents and SAR layers.
+//! Changes are staged in memory until commit(): a run that fails before its
+//! documents are sent leaves the index as it was, and lookups only see the
+//! state of committed runs.
+//! All methods are thread-safe.
+class T_crawl_state_index
+{
+public:
+  enum Outcome { UNKNOWN = 0, LOADED_OK = 1, LOADED_KO = 2 };
+
+  //! @brief Open or create the index file
+  //! @exception E_system if the file cannot be created or mapped
+  T_crawl_state_index(const std::string& filepath);
+  ~T_crawl_state_index();
+
+  //! @brief Returns true if the file was loaded successfully by a previous
+  //! run with the same mtime, ctime and size
+  bool is_unchanged(const std::string& uri, const T_file_info& info) const;
+
+  //! @brief Stage the attributes of a loaded file, once its document is sent
+  void update(const std::string& uri, const T_file_info& info, Outcome outcome);
+
+  //! @brief Get the digest of the contents layer of a file
+  //! @param mtime (out) mtime of the file when its contents had this digest
+  //! @return false if unknown
+  bool get_digest(const std::string& uri, uint64_t& digest, time_t& mtime) const;
+
+  //! @brief Stage the digest of the contents layer of a file, read at mtime
+  void set_digest(const std::string& uri, uint64_t digest, time_t mtime);
+
+  //! @brief Get the key of the ACLs the SAR layer of a file was built from
+  //! @return false if unknown
+  bool get_sar_key(const std::string& uri, uint64_t& sar_key) const;
+
+  //! @brief Stage the key of the ACLs of the SAR layer of a file
+  void set_sar_key(const std::string& uri, uint64_t sar_key);
+
+  //! @brief Drop the staged changes of a file whose document was not sent
+  void discard(const std::string& uri);
+
+  //! @brief Write the staged changes, once the documents of the run are sent
+  //! @exception E_system if the index cannot grow
+  void commit();
+
+  //! @brief Forget a file (eg deleted from PaF)
+  void remove(const std::string& uri);
+
+  //! @brief Number of files in the index
+  uint64_t size() const;
+
+private:
+  struct T_header
+  {
+    char      magic[8];
+    uint32_t  version;
+    uint32_t  slot_size;
+    uint64_t  capacity;   // power of 2
+    uint64_t  count;
+  };
+
+  struct T_slot
+  {
+    uint64_t  key;        // 0 for empty slots
+    int64_t   mtime;
+    int64_t   ctime;
+    uint64_t  size;
+    uint32_t  outcome;
+    uint32_t  reserved;
+    uint64_t  digest;     // 0 if unknown
+    int64_t   digest_mtime;
+    uint64_t  sar_key;    // 0 if unknown
+  };
+
+  // Staged slot, fields left to zero are not changed
+  typedef boost::unordered_map<uint64_t, T_slot> T_staged_slots;
+
+  std::string           _filepath;
+  int                   _fd;
+  size_t                _mapped_size;
+  T_header*             _header;
+  T_slot*               _slots;
+  T_staged_slots        _staged;
+  mutable boost::mutex  _mutex;
+
+  static uint64_t key(const std::string& uri);
+  void create(const std::string& filepath, uint64_t capacity,
+              int& fd, size_t& mapped_size, T_header*& header);
+  void unmap();
+  void grow();
+  T_slot* find(uint64_t key) const;
+  T_slot* insert(uint64_t key);
+  T_slot* insert_or_grow(uint64_t key);
+};
+
+#endif // _FILESYSTEM_STATE_H_
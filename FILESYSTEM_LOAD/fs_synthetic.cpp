@@ -0,0 +1,438 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Synthetic in-memory filesystem
+ *
+ ***************************************************************************/
+
+#include "fs_synthetic.h"
+#include "fs_digest.h"
+
+#include <AFS/SECURITY/unix_acl.h>
+#include <COMMON/BASIC/log.h>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/ref.hpp>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace N_Security;
+using namespace boost;
+
+namespace {
+  static const size_t read_chunk_size = 1024 * 1024;
+
+  inline uint32_t nb_digits(uint32_t count)
+  {
+    uint32_t digits = 1;
+    for (uint32_t max = (count > 0) ? count - 1 : 0; max >= 10; max /= 10)
+      {
+        ++digits;
+      }
+    return digits;
+  }
+
+  //! @brief Append prefix and index padded with zeros to width digits
+  inline void append_name(std::string& path, char prefix,
+                          uint32_t index, uint32_t width)
+  {
+    char name[16];
+    int length = snprintf(name, sizeof(name), "%c%0*u", prefix, width, index);
+    path.append(name, length);
+  }
+
+  //! @brief Parse a name made by append_name, false if it is not
+  inline bool parse_name(const char* name, size_t length,
+                         char& prefix, uint32_t& index)
+  {
+    if (length < 2 || length > 11)
+      {
+        return false;
+      }
+    prefix = name[0];
+    index = 0;
+    for (size_t i = 1; i < length; ++i)
+      {
+        if (name[i] < '0' || name[i] > '9')
+          {
+            return false;
+          }
+        index = index * 10 + (name[i] - '0');
+      }
+    return true;
+  }
+
+  //! @brief Content of a synthetic file, pseudo-random and reproducible
+  struct T_content_generator
+  {
+    T_content_generator(uint64_t seed, uint64_t size)
+      : state(seed | 1), remaining(size) {}
+
+    ssize_t operator()(char* buffer, size_t count)
+    {
+      size_t length = std::min<uint64_t>(count, remaining);
+      for (size_t offset = 0; offset < length; offset += sizeof(state))
+        {
+          // xorshift64
+          state ^= state << 13;
+          state ^= state >> 7;
+          state ^= state << 17;
+          memcpy(buffer + offset, &state,
+                 std::min(sizeof(state), length - offset));
+        }
+      remaining -= length;
+      return length;
+    }
+
+    uint64_t state;
+    uint64_t remaining;
+  };
+} // namespace
+
+/*****************************************************************************/
+T_synthetic_config::T_synthetic_config()
+  : depth(4),
+    nb_subdirectories(8),
+    nb_files(16),
+    min_file_size(1024),
+    max_file_size(1024 * 1024),
+    nb_acls(16),
+    seed(0),
+    mtime(1356998400),
+    work_dir("/tmp")
+{
+}
+
+/*****************************************************************************/
+const std::string T_synthetic_filesystem::root_path = "/synthetic";
+
+/*****************************************************************************/
+T_synthetic_filesystem::T_synthetic_filesystem(T_filesystem_config_ptr conf)
+  : T_filesystem_proxy(conf),
+    _config(dynamic_pointer_cast<T_synthetic_config>(conf))
+{
+  assert(_config.get());
+  _uri_prefix = "synthetic://" + _config->remote_host;
+}
+
+/*****************************************************************************/
+T_synthetic_filesystem::~T_synthetic_filesystem()
+{
+}
+
+/*****************************************************************************/
+uint64_t T_synthetic_filesystem::nb_entries() const
+{
+  uint64_t nb_directories = 0;
+  uint64_t level_size = 1;
+  for (uint32_t level = 0; level <= _config->depth; ++level)
+    {
+      nb_directories += level_size;
+      level_size *= _config->nb_subdirectories;
+    }
+  return nb_directories * (1 + _config->nb_files);
+}
+
+/*****************************************************************************/
+void T_synthetic_filesystem::connect()
+{
+  // Permissions are read from a real file, with distinct names mapped to
+  // its owner and group: as many ACLs as wanted, without privileges
+  _acls.clear();
+  if (_config->nb_acls == 0)
+    {
+      return;
+    }
+  string template_path = _config->work_dir + "/synthetic_acl."
+                           + lexical_cast<string>(getpid());
+  int fd = open(template_path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0640);
+  if (fd < 0)
+    {
+      string errmsg (strerror(errno));
+      throw E_system("Could not create file: " + template_path + ": " + errmsg);
+    }
+  close(fd);
+
+  T_on_uid_mapping_miss on_mapping_miss;
+  for (uint32_t i = 0; i < _config->nb_acls; ++i)
+    {
+      std::map<uint32_t, string> users_mapping;
+      std::map<uint32_t, string> groups_mapping;
+      users_mapping[getuid()] = "synthetic_user_" + lexical_cast<string>(i);
+      groups_mapping[getgid()] = "synthetic_group_" + lexical_cast<string>(i);
+      _acls.push_back(build_acl_from_unix_path(template_path,
+                                               users_mapping,
+                                               groups_mapping,
+                                               on_mapping_miss));
+    }
+  unlink(template_path.c_str());
+  LOG(INFO, 5) << "Synthetic filesystem: " << nb_entries() << " entries, "
+               << _acls.size() << " ACLs";
+}
+
+/*****************************************************************************/
+void T_synthetic_filesystem::disconnect()
+{
+}
+
+/*****************************************************************************/
+T_url_ptr
+T_synthetic_filesystem::create_url(const N_Uri::T_uri& uri) const
+{
+  return T_url_ptr(new T_synthetic_url(root_path + uri.path(), *this));
+}
+
+/*****************************************************************************/
+T_url_ptr
+T_synthetic_filesystem::create_url(const std::string& fs_path) const
+{
+  return T_url_ptr(new T_synthetic_url(fs_path, *this));
+}
+
+/*****************************************************************************/
+uint64_t T_synthetic_filesystem::get_hash(const char* path, size_t length) const
+{
+  while (length > 1 && path[length - 1] == '/')
+    {
+      --length;
+    }
+  return xxhash64(path, length, _config->seed);
+}
+
+/*****************************************************************************/
+bool T_synthetic_filesystem::get_info(const std::string& path,
+                                      T_file_info& info,
+                                      uint32_t& depth) const
+{
+  if (path.compare(0, root_path.size(), root_path) != 0)
+    {
+      return false;
+    }
+
+  info.type = T_file_info::DIRECTORY;
+  depth = 0;
+  size_t begin = root_path.size();
+  while (begin < path.size())
+    {
+      if (path[begin] == '/')
+        {
+          ++begin;
+          continue;
+        }
+      if (info.type != T_file_info::DIRECTORY)
+        {
+          return false; // below a file
+        }
+      size_t end = path.find('/', begin);
+      if (end == string::npos)
+        {
+          end = path.size();
+        }
+      char prefix;
+      uint32_t index;
+      if (not parse_name(path.data() + begin, end - begin, prefix, index))
+        {
+          return false;
+        }
+      if (prefix == 'd' && depth < _config->depth
+          && index < _config->nb_subdirectories)
+        {
+          ++depth;
+        }
+      else if (prefix == 'f' && index < _config->nb_files)
+        {
+          info.type = T_file_info::REGULAR_FILE;
+        }
+      else
+        {
+          return false;
+        }
+      begin = end;
+    }
+
+  uint64_t hash = get_hash(path.data(), path.size());
+  info.has_attributes = true;
+  info.mtime = _config->mtime;
+  info.ctime = _config->mtime;
+  info.inode = hash;
+  if (info.type == T_file_info::DIRECTORY)
+    {
+      info.size = 4096;
+      info.mode = S_IFDIR | 0755;
+    }
+  else
+    {
+      // Log-uniform size: small files are many, large files are most bytes
+      double min_size = std::max<uint64_t>(_config->min_file_size, 1);
+      double max_size = std::max<double>(_config->max_file_size, min_size);
+      double ratio = static_cast<double>(hash >> 11) / (1ULL << 53);
+      info.size = static_cast<uint64_t>(min_size * pow(max_size / min_size,
+                                                       ratio));
+      info.mode = S_IFREG | 0644;
+    }
+  return true;
+}
+
+/*****************************************************************************/
+bool T_synthetic_filesystem::check_if_file_exists(const T_url& url)
+{
+  T_file_info info;
+  uint32_t depth;
+  return get_info(url.get_local_path(), info, depth);
+}
+
+/*****************************************************************************/
+void T_synthetic_filesystem::list_directory(const T_url& url,
+                                            T_directory_entries& entries)
+{
+  const string& local_path = url.get_local_path();
+  T_file_info info;
+  uint32_t depth;
+  if (not get_info(local_path, info, depth)
+      || info.type != T_file_info::DIRECTORY)
+    {
+      throw E_system("Could not open directory: " + local_path);
+    }
+
+  uint32_t nb_subdirectories = (depth < _config->depth)
+                                 ? _config->nb_subdirectories : 0;
+  uint32_t subdirectory_width = nb_digits(_config->nb_subdirectories);
+  uint32_t file_width = nb_digits(_config->nb_files);
+  entries.reserve(nb_subdirectories + _config->nb_files,
+                  nb_subdirectories * (subdirectory_width + 1)
+                  + _config->nb_files * (file_width + 1));
+
+  // Names have a fixed width: "d..." then "f...", already sorted
+  string entry_path = local_path;
+  if (entry_path[entry_path.size() - 1] != '/')
+    {
+      entry_path += '/';
+    }
+  const size_t dir_path_length = entry_path.size();
+  T_file_info entry_info;
+  uint32_t entry_depth;
+  for (uint32_t i = 0; i < nb_subdirectories; ++i)
+    {
+      entry_path.resize(dir_path_length);
+      append_name(entry_path, 'd', i, subdirectory_width);
+      get_info(entry_path, entry_info, entry_depth);
+      entries.add(entry_path.data() + dir_path_length,
+                  entry_path.size() - dir_path_length, entry_info);
+    }
+  for (uint32_t i = 0; i < _config->nb_files; ++i)
+    {
+      entry_path.resize(dir_path_length);
+      append_name(entry_path, 'f', i, file_width);
+      get_info(entry_path, entry_info, entry_depth);
+      entries.add(entry_path.data() + dir_path_length,
+                  entry_path.size() - dir_path_length, entry_info);
+    }
+}
+
+/*****************************************************************************/
+bool
+T_synthetic_filesystem::read_file_content(const T_url& url,
+                                          const T_file_info& /* info */,
+                                          string& data,
+                                          uint64_t max_size)
+{
+  const string& local_path = url.get_local_path();
+  T_file_info info;
+  uint32_t depth;
+  if (not get_info(local_path, info, depth)
+      || info.type != T_file_info::REGULAR_FILE)
+    {
+      throw E_system("Could not open file: " + local_path);
+    }
+  T_content_generator generator(info.inode, info.size);
+  return read_chunks(boost::ref(generator), read_chunk_size,
+                     info.size, data, max_size);
+}
+
+/*****************************************************************************/
+ACL T_synthetic_filesystem::read_url_permissions(const T_url& url)
+{
+  return read_url_permissions(url.get_local_path());
+}
+
+/*****************************************************************************/
+ACL T_synthetic_filesystem::read_url_permissions(const string& localpath)
+{
+  if (_acls.empty())
+    {
+      return ACL();
+    }
+  return _acls[get_hash(localpath.data(), localpath.size()) % _acls.size()];
+}
+
+/*****************************************************************************/
+void T_synthetic_filesystem::read_file_info(const T_url& url, T_file_info& info)
+{
+  const string& local_path = url.get_local_path();
+  uint32_t depth;
+  if (not get_info(local_path, info, depth))
+    {
+      throw E_system("Could not stat file: " + local_path
+                     + ": " + strerror(ENOENT));
+    }
+}
+
+/*****************************************************************************/
+T_synthetic_url::T_synthetic_url(const std::string& local_path,
+                                 const T_synthetic_filesystem& fs)
+{
+  _uri_prefix = &fs.uri_prefix();
+  _local_path = local_path;
+  if (_local_path.compare(0, T_synthetic_filesystem::root_path.size(),
+                          T_synthetic_filesystem::root_path) == 0)
+    {
+      _root_offset = T_synthetic_filesystem::root_path.size();
+    }
+}
+
+/*****************************************************************************/
+T_synthetic_acl::T_synthetic_acl(T_synthetic_filesystem& fs)
+  : T_filesystem_acl(fs)
+{
+}
+
+/*****************************************************************************/
+T_synthetic_acl::~T_synthetic_acl()
+{
+}
+
+/*****************************************************************************/
+SAR T_synthetic_acl::compute_sar_layer(const T_url& url)
+{
+  return build_sar_from_unix_acl(url.get_local_path(), *this);
+}
+
+/*****************************************************************************/
+void T_synthetic_acl::log_mapping_errors(AFS::PaF::Handle& /* handle */)
+{
+  // Names are made up for the owner and group: nothing to report
+}
@@ -0,0 +1,126 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Synthetic in-memory filesystem
+ *
+ ***************************************************************************/
+#ifndef _FILESYSTEM_SYNTHETIC_H_
+#define _FILESYSTEM_SYNTHETIC_H_
+
+#include "fs_proxy.h"
+
+#include <vector>
+
+/*****************************************************************************/
+//! @brief Shape of a synthetic tree
+struct T_synthetic_config : public T_filesystem_config {
+  T_synthetic_config();
+
+  uint32_t      depth;              // levels of subdirectories below the root
+  uint32_t      nb_subdirectories;  // in each directory above the last level
+  uint32_t      nb_files;           // in each directory
+  uint64_t      min_file_size;
+  uint64_t      max_file_size;      // sizes are log-uniform between min and max
+  uint32_t      nb_acls;            // distinct permissions of the entries
+  uint64_t      seed;               // same seed, same tree
+  time_t        mtime;              // of all entries
+  std::string   work_dir;           // scratch directory used by connect()
+};
+
+typedef boost::shared_ptr<T_synthetic_config> T_synthetic_config_ptr;
+
+/*****************************************************************************/
+//! @brief Filesystem proxy generating a tree from its configuration
+//! Nothing is stored: listings, attributes and contents are derived from
+//! the entry paths, so that crawl performance can be measured without a
+//! remote filesystem. Directories are named "dNNN" and files "fNNNN".
+//! Safe for concurrent use once connected.
+class T_synthetic_filesystem : public T_filesystem_proxy
+{
+public:
+  //! @brief Local path of the root of the tree
+  static const std::string root_path;
+
+  T_synthetic_filesystem(T_filesystem_config_ptr conf);
+  virtual ~T_synthetic_filesystem();
+
+  //! @brief URI of the root ie synthetic://host
+  const std::string& uri_prefix() const { return _uri_prefix; }
+
+  //! @brief Total number of directories and files of the tree
+  uint64_t nb_entries() const;
+
+  //! @brief Build the permissions handed out for the entries
+  //! @exception E_system if the work directory cannot be used
+  virtual void connect();
+  virtual void disconnect();
+
+  virtual T_url_ptr create_url(const N_Uri::T_uri& uri) const;
+  virtual T_url_ptr create_url(const std::string& fs_path) const;
+  virtual bool check_if_file_exists(const T_url& url);
+  virtual void list_directory(const T_url& url,
+                              T_directory_entries& entries);
+  virtual bool read_file_content(const T_url& url,
+                                 const T_file_info& info,
+                                 std::string& data,
+                                 uint64_t max_size);
+  virtual N_Security::ACL read_url_permissions(const T_url& url);
+  virtual N_Security::ACL read_url_permissions(const string& localpath);
+  virtual void read_file_info(const T_url& url, T_file_info& info);
+
+private:
+  T_synthetic_config_ptr        _config;
+  std::string                   _uri_prefix;
+  std::vector<N_Security::ACL>  _acls;
+
+  //! @brief Attributes of an entry, false if it is not part of the tree
+  //! @param depth (out) level of the entry, 0 for the root
+  bool get_info(const std::string& path, T_file_info& info,
+                uint32_t& depth) const;
+  uint64_t get_hash(const char* path, size_t length) const;
+};
+
+/*****************************************************************************/
+//! @brief URL of a synthetic entry, the local path below root_path
+class T_synthetic_url : public T_url
+{
+public:
+  T_synthetic_url(const std::string& local_path,
+                  const T_synthetic_filesystem& fs);
+};
+
+/*****************************************************************************/
+//! @brief Permissions of synthetic entries, SAR built as for mounted ones
+class T_synthetic_acl : public T_filesystem_acl
+{
+public:
+  T_synthetic_acl(T_synthetic_filesystem& fs);
+  virtual ~T_synthetic_acl();
+
+  virtual N_Security::SAR compute_sar_layer(const T_url& url);
+  virtual void log_mapping_errors(AFS::PaF::Handle& handle);
+
+protected:
+  virtual bool inherits_ancestors_acls() const { return true; }
+};
+
+#endif // _FILESYSTEM_SYNTHETIC_H_
@@ -0,0 +1,612 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Batched file I/O with io_uring
+ *
+ ***************************************************************************/
+
+#include "fs_uring.h"
+
+#include <COMMON/BASIC/log.h>
+
+#include <errno.h>
+#include <string.h>
+
+#ifdef FS_WITH_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <limits>
+
+namespace {
+  // Largest read submitted at once (the length of an operation is 32-bit)
+  static const uint64_t max_read_length = 1024 * 1024 * 1024;
+  // Smallest growth of a buffer filled before the end of the file
+  static const uint64_t min_buffer_growth = 64 * 1024;
+
+  inline std::string system_error(const std::string& message)
+  {
+    return message + ": " + strerror(errno);
+  }
+
+  inline unsigned load_acquire(const unsigned* p)
+  {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+  }
+
+  inline void store_release(unsigned* p, unsigned value)
+  {
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+  }
+
+  //! @brief Progress of a file read by read_files()
+  struct T_pending_read
+  {
+    enum Step { OPEN, READ, CLOSE };
+
+    Step      step;
+    int       fd;       // -1 once closed
+    uint64_t  length;   // bytes read
+  };
+
+  typedef std::vector<std::pair<__u64, __s32> > T_completions;
+
+  void statx_to_stat(const struct statx& from, struct stat& to)
+  {
+    memset(&to, 0, sizeof(to));
+    to.st_mode = from.stx_mode;
+    to.st_size = from.stx_size;
+    to.st_ino = from.stx_ino;
+    to.st_nlink = from.stx_nlink;
+    to.st_uid = from.stx_uid;
+    to.st_gid = from.stx_gid;
+    to.st_blocks = from.stx_blocks;
+    to.st_mtime = from.stx_mtime.tv_sec;
+    to.st_ctime = from.stx_ctime.tv_sec;
+    to.st_atime = from.stx_atime.tv_sec;
+  }
+} // namespace
+
+/*****************************************************************************/
+//! @brief A submission and completion queue pair, used by a single thread
+class T_io_uring : private boost::noncopyable
+{
+public:
+  T_io_uring(unsigned entries);
+  ~T_io_uring();
+
+  //! @brief Next free submission entry, zeroed, NULL if the queue is full
+  struct io_uring_sqe* get_sqe();
+
+  //! @brief Submit queued entries and wait for at least one completion
+  void submit_and_wait();
+
+  //! @brief Next completion, false if none
+  bool peek(__u64& user_data, __s32& result);
+
+  //! @brief Submit queued entries and wait for nb_expected completions
+  //! Used after an error: buffers and descriptors of the operations in
+  //! flight can only be released once they are over. Aborts if the ring
+  //! can no longer be waited on.
+  void wait_completions(size_t nb_expected, T_completions& completions);
+
+private:
+  //! @brief Unmap the queues and close the ring, of a ring partly set up too
+  void release();
+
+  int                   _fd;
+  void*                 _sq_ring;
+  size_t                _sq_ring_size;
+  void*                 _cq_ring;
+  size_t                _cq_ring_size;
+  struct io_uring_sqe*  _sqes;
+  size_t                _sqes_size;
+
+  unsigned*             _sq_head;
+  unsigned*             _sq_tail;
+  unsigned*             _sq_mask;
+  unsigned*             _sq_array;
+  unsigned*             _cq_head;
+  unsigned*             _cq_tail;
+  unsigned*             _cq_mask;
+  struct io_uring_cqe*  _cqes;
+  unsigned              _sq_entries;
+  unsigned              _nb_queued;  // filled since the last submit
+};
+
+/*****************************************************************************/
+T_io_uring::T_io_uring(unsigned entries)
+  : _sq_ring(MAP_FAILED), _cq_ring(MAP_FAILED), _sqes(NULL), _nb_queued(0)
+{
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  _fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (_fd < 0)
+    {
+      throw E_system(system_error("Could not create io_uring"));
+    }
+
+  _sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  _cq_ring_size = params.cq_off.cqes
+                  + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+      _sq_ring_size = _cq_ring_size = std::max(_sq_ring_size, _cq_ring_size);
+    }
+  _sq_ring = mmap(NULL, _sq_ring_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+  if (_sq_ring != MAP_FAILED)
+    {
+      _cq_ring = (params.features & IORING_FEAT_SINGLE_MMAP)
+                 ? _sq_ring
+                 : mmap(NULL, _cq_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+    }
+  _sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  void* sqes = (_cq_ring == MAP_FAILED) ? MAP_FAILED
+               : mmap(NULL, _sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED)
+    {
+      std::string message = system_error("Could not map io_uring");
+      release();
+      throw E_system(message);
+    }
+  _sqes = static_cast<struct io_uring_sqe*>(sqes);
+
+  char* sq = static_cast<char*>(_sq_ring);
+  _sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  _sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  _sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  _sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  char* cq = static_cast<char*>(_cq_ring);
+  _cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  _cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  _cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  _cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+  _sq_entries = params.sq_entries;
+}
+
+/*****************************************************************************/
+T_io_uring::~T_io_uring()
+{
+  release();
+}
+
+/*****************************************************************************/
+void T_io_uring::release()
+{
+  if (_sqes != NULL)
+    {
+      munmap(_sqes, _sqes_size);
+    }
+  if (_cq_ring != MAP_FAILED && _cq_ring != _sq_ring)
+    {
+      munmap(_cq_ring, _cq_ring_size);
+    }
+  if (_sq_ring != MAP_FAILED)
+    {
+      munmap(_sq_ring, _sq_ring_size);
+    }
+  close(_fd);
+}
+
+/*****************************************************************************/
+struct io_uring_sqe* T_io_uring::get_sqe()
+{
+  unsigned tail = *_sq_tail;
+  if (tail - load_acquire(_sq_head) >= _sq_entries)
+    {
+      return NULL;
+    }
+  unsigned index = tail & *_sq_mask;
+  struct io_uring_sqe* sqe = &_sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  _sq_array[index] = index;
+  store_release(_sq_tail, tail + 1);
+  ++_nb_queued;
+  return sqe;
+}
+
+/*****************************************************************************/
+void T_io_uring::submit_and_wait()
+{
+  for (;;)
+    {
+      int nb_submitted = syscall(__NR_io_uring_enter, _fd, _nb_queued, 1,
+                                 IORING_ENTER_GETEVENTS, NULL, 0);
+      if (nb_submitted >= 0)
+        {
+          _nb_queued -= nb_submitted;
+          return;
+        }
+      if (errno != EINTR)
+        {
+          throw E_system(system_error("Could not submit to io_uring"));
+        }
+    }
+}
+
+/*****************************************************************************/
+bool T_io_uring::peek(__u64& user_data, __s32& result)
+{
+  unsigned head = *_cq_head;
+  if (head == load_acquire(_cq_tail))
+    {
+      return false;
+    }
+  const struct io_uring_cqe& cqe = _cqes[head & *_cq_mask];
+  user_data = cqe.user_data;
+  result = cqe.res;
+  store_release(_cq_head, head + 1);
+  return true;
+}
+
+/*****************************************************************************/
+void T_io_uring::wait_completions(size_t nb_expected, T_completions& completions)
+{
+  completions.clear();
+  for (;;)
+    {
+      __u64 user_data;
+      __s32 result;
+      while (completions.size() < nb_expected && peek(user_data, result))
+        {
+          completions.push_back(std::make_pair(user_data, result));
+        }
+      if (completions.size() >= nb_expected)
+        {
+          return;
+        }
+      int nb_submitted = syscall(__NR_io_uring_enter, _fd, _nb_queued, 1,
+                                 IORING_ENTER_GETEVENTS, NULL, 0);
+      if (nb_submitted >= 0)
+        {
+          _nb_queued -= nb_submitted;
+        }
+      else if (errno == EAGAIN)
+        {
+          usleep(1000);
+        }
+      else if (errno != EINTR && errno != EBUSY)
+        {
+          LOG(ERROR, 1) << system_error("Could not wait for io_uring operations");
+          abort();
+        }
+    }
+}
+
+/*****************************************************************************/
+//! @brief A ring used by a single batch at a time
+class T_uring_engine::T_ring_lease : private boost::noncopyable
+{
+public:
+  T_ring_lease(T_uring_engine& engine)
+    : _engine(engine), _ring(engine.acquire_ring()) {}
+  ~T_ring_lease() { _engine.release_ring(_ring); }
+
+  T_io_uring& ring() { return _ring; }
+
+private:
+  T_uring_engine& _engine;
+  T_io_uring&     _ring;
+};
+
+/*****************************************************************************/
+T_uring_engine::T_uring_engine(uint32_t queue_depth)
+  : _queue_depth(std::max<uint32_t>(queue_depth, 1))
+{
+  // Fails early if io_uring or its statx operation is not available
+  std::vector<T_stat_request> requests(1, T_stat_request(AT_FDCWD, "/"));
+  stat_at(requests);
+  if (requests[0].error != 0)
+    {
+      errno = requests[0].error;
+      throw E_system(system_error("io_uring statx not supported"));
+    }
+}
+
+/*****************************************************************************/
+T_uring_engine::~T_uring_engine()
+{
+}
+
+/*****************************************************************************/
+T_io_uring& T_uring_engine::acquire_ring()
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  if (not _free_rings.empty())
+    {
+      T_io_uring* ring = _free_rings.back();
+      _free_rings.pop_back();
+      return *ring;
+    }
+  _free_rings.reserve(_rings.size() + 1);
+  _rings.push_back(new T_io_uring(_queue_depth));
+  return _rings.back();
+}
+
+void T_uring_engine::release_ring(T_io_uring& ring)
+{
+  boost::mutex::scoped_lock lock(_mutex);
+  _free_rings.push_back(&ring);
+}
+
+/*****************************************************************************/
+void T_uring_engine::stat_at(std::vector<T_stat_request>& requests)
+{
+  T_ring_lease lease(*this);
+  T_io_uring& uring = lease.ring();
+  std::vector<struct statx> results(requests.size());
+  size_t nb_submitted = 0;
+  size_t nb_completed = 0;
+  try
+    {
+      while (nb_completed < requests.size())
+        {
+          for (; nb_submitted < requests.size()
+                 && nb_submitted - nb_completed < _queue_depth; ++nb_submitted)
+            {
+              struct io_uring_sqe* sqe = uring.get_sqe();
+              if (sqe == NULL)
+                {
+                  break;
+                }
+              sqe->opcode = IORING_OP_STATX;
+              sqe->fd = requests[nb_submitted].dir_fd;
+              sqe->addr = reinterpret_cast<__u64>(requests[nb_submitted].path);
+              sqe->len = STATX_BASIC_STATS;
+              sqe->off = reinterpret_cast<__u64>(&results[nb_submitted]);
+              sqe->user_data = nb_submitted;
+            }
+          uring.submit_and_wait();
+
+          __u64 index;
+          __s32 result;
+          while (uring.peek(index, result))
+            {
+              ++nb_completed;
+              if (result < 0)
+                {
+                  requests[index].error = -result;
+                }
+              else
+                {
+                  statx_to_stat(results[index], requests[index].result);
+                }
+            }
+        }
+    }
+  catch(...)
+    {
+      // Results are written until the queued operations are over
+      T_completions completions;
+      uring.wait_completions(nb_submitted - nb_completed, completions);
+      throw;
+    }
+}
+
+/*****************************************************************************/
+void T_uring_engine::read_files(std::vector<T_read_request>& requests,
+                                uint64_t max_size)
+{
+  // Each file goes through open, reads until end of file or max_size + 1
+  // bytes (to detect larger files), then close
+  const uint64_t read_limit = (max_size < std::numeric_limits<uint64_t>::max())
+    ? max_size + 1 : max_size;
+  T_ring_lease lease(*this);
+  T_io_uring& uring = lease.ring();
+  std::vector<T_pending_read> files(requests.size());
+  std::deque<size_t> ready; // files with an operation to submit
+  for (size_t i = 0; i < requests.size(); ++i)
+    {
+      files[i].step = T_pending_read::OPEN;
+      files[i].fd = -1;
+      files[i].length = 0;
+      requests[i].data->clear();
+      ready.push_back(i);
+    }
+
+  size_t nb_pending = 0; // submitted, not completed
+  size_t nb_done = 0;
+  try
+    {
+      while (nb_done < requests.size())
+        {
+          while (not ready.empty() && nb_pending < _queue_depth)
+            {
+              size_t i = ready.front();
+              T_pending_read& file = files[i];
+              T_read_request& request = requests[i];
+              std::string& data = *request.data;
+              if (file.step == T_pending_read::READ && file.length == data.size())
+                {
+                  // Buffer is sized on the expected size, grown if the file
+                  // is larger; done before taking an entry as it may throw
+                  uint64_t capacity = (file.length == 0)
+                    ? std::min(request.size_hint, read_limit - 1) + 1
+                    : std::min(std::max(file.length * 2,
+                                        file.length + min_buffer_growth),
+                               read_limit);
+                  data.resize(std::max(capacity, file.length + 1));
+                }
+
+              struct io_uring_sqe* sqe = uring.get_sqe();
+              if (sqe == NULL)
+                {
+                  break;
+                }
+              ready.pop_front();
+              if (file.step == T_pending_read::OPEN)
+                {
+                  sqe->opcode = IORING_OP_OPENAT;
+                  sqe->fd = request.dir_fd;
+                  sqe->addr = reinterpret_cast<__u64>(request.path);
+                  sqe->open_flags = O_RDONLY | O_CLOEXEC;
+                }
+              else if (file.step == T_pending_read::READ)
+                {
+                  sqe->opcode = IORING_OP_READ;
+                  sqe->fd = file.fd;
+                  sqe->addr = reinterpret_cast<__u64>(&data[file.length]);
+                  sqe->len = std::min(data.size() - file.length, max_read_length);
+                  sqe->off = file.length;
+                }
+              else
+                {
+                  sqe->opcode = IORING_OP_CLOSE;
+                  sqe->fd = file.fd;
+                }
+              sqe->user_data = i;
+              ++nb_pending;
+            }
+          uring.submit_and_wait();
+
+          __u64 index;
+          __s32 result;
+          while (uring.peek(index, result))
+            {
+              --nb_pending;
+              T_pending_read& file = files[index];
+              T_read_request& request = requests[index];
+              if (file.step == T_pending_read::OPEN)
+                {
+                  if (result < 0)
+                    {
+                      request.error = -result;
+                      ++nb_done;
+                      continue;
+                    }
+                  file.fd = result;
+                  file.step = T_pending_read::READ;
+                }
+              else if (file.step == T_pending_read::READ)
+                {
+                  if (result == -EINTR || result == -EAGAIN)
+                    {
+                      ready.push_back(index);
+                      continue;
+                    }
+                  if (result < 0)
+                    {
+                      request.error = -result;
+                      file.step = T_pending_read::CLOSE;
+                    }
+                  else
+                    {
+                      file.length += result;
+                      if (result == 0 || file.length > max_size)
+                        {
+                          request.complete = (file.length <= max_size);
+                          file.step = T_pending_read::CLOSE;
+                        }
+                    }
+                }
+              else
+                {
+                  file.fd = -1;
+                  request.data->resize(std::min(file.length, max_size));
+                  if (request.error != 0)
+                    {
+                      request.data->clear();
+                    }
+                  ++nb_done;
+                  continue;
+                }
+              ready.push_back(index);
+            }
+        }
+    }
+  catch(...)
+    {
+      // Buffers are written until the queued operations are over, then the
+      // files still open are closed
+      T_completions completions;
+      uring.wait_completions(nb_pending, completions);
+      for (size_t c = 0; c < completions.size(); ++c)
+        {
+          T_pending_read& file = files[completions[c].first];
+          if (file.step == T_pending_read::OPEN && completions[c].second >= 0)
+            {
+              file.fd = completions[c].second;
+            }
+          else if (file.step == T_pending_read::CLOSE)
+            {
+              file.fd = -1;
+            }
+        }
+      for (size_t i = 0; i < files.size(); ++i)
+        {
+          if (files[i].fd >= 0)
+            {
+              close(files[i].fd);
+            }
+        }
+      throw;
+    }
+}
+
+#else // FS_WITH_IO_URING
+
+/*****************************************************************************/
+class T_io_uring
+{
+};
+
+/*****************************************************************************/
+T_uring_engine::T_uring_engine(uint32_t queue_depth)
+  : _queue_depth(queue_depth)
+{
+  throw E_system("io_uring support not built (FS_WITH_IO_URING)");
+}
+
+T_uring_engine::~T_uring_engine()
+{
+}
+
+T_io_uring& T_uring_engine::acquire_ring()
+{
+  throw E_system("io_uring support not built (FS_WITH_IO_URING)");
+}
+
+void T_uring_engine::release_ring(T_io_uring& /* ring */)
+{
+}
+
+void T_uring_engine::stat_at(std::vector<T_stat_request>& /* requests */)
+{
+  acquire_ring();
+}
+
+void T_uring_engine::read_files(std::vector<T_read_request>& /* requests */,
+                                uint64_t /* max_size */)
+{
+  acquire_ring();
+}
+
+#endif // FS_WITH_IO_URING
@@ -0,0 +1,112 @@
+/*
+* Copyright 2013 Antidot opensource@antidot.net
+https://github.com/antidot/AIF-Filters/
+*
+* afs_filesystem_load is free software; you can redistribute it and/or
+* modify it under the terms of the GNU General Public License as
+* published by the Free Software Foundation; either version 2 of
+* the License, or (at your option) any later version.
+*
+* afs_filesystem_load is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/***************************************************************************
+ *
+ * (C) 2013 Antidot
+ *
+ * Description          : Batched file I/O with io_uring
+ *
+ ***************************************************************************/
+
+#ifndef _FILESYSTEM_URING_H_
+#define _FILESYSTEM_URING_H_
+
+#include <COMMON/META/antidot.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+class T_io_uring;
+
+/*****************************************************************************/
+//! @brief A stat of a path relative to a directory (symbolic links followed)
+struct T_stat_request
+{
+  T_stat_request(int at_fd, const char* at_path)
+    : dir_fd(at_fd), path(at_path), error(0) {}
+
+  int         dir_fd;   // or AT_FDCWD
+  const char* path;
+  struct stat result;
+  int         error;    // errno, 0 on success
+};
+
+/*****************************************************************************/
+//! @brief A read of a whole file, relative to a directory
+struct T_read_request
+{
+  T_read_request(int at_fd, const char* at_path, uint64_t expected_size,
+                 std::string& content)
+    : dir_fd(at_fd), path(at_path), size_hint(expected_size),
+      data(&content), complete(false), error(0) {}
+
+  int           dir_fd;     // or AT_FDCWD
+  const char*   path;
+  uint64_t      size_hint;  // content is allocated once if exact
+  std::string*  data;       // (out) at most max_size bytes
+  bool          complete;   // (out) false if the file is larger than max_size
+  int           error;      // (out) errno, 0 on success
+};
+
+/*****************************************************************************/
+//! @brief Runs many stat, open, read and close calls with few syscalls
+//! Operations of a batch are queued in an io_uring, up to queue_depth at
+//! once: their latencies overlap instead of adding up, which matters on NFS.
+//! A batch uses a ring of its own, kept for later batches: there are as
+//! many rings as concurrent batches (ie crawl workers), whatever the number
+//! of threads. Requires Linux 5.6 and a build with FS_WITH_IO_URING
+//! defined, the constructor throws E_system otherwise.
+class T_uring_engine : private boost::noncopyable
+{
+public:
+  //! @exception E_system if io_uring is not supported
+  T_uring_engine(uint32_t queue_depth);
+  ~T_uring_engine();
+
+  uint32_t queue_depth() const { return _queue_depth; }
+
+  //! @brief Stat all the paths, errors are reported in each request
+  //! @exception E_system if the ring cannot be used, once all the queued
+  //! operations are over
+  void stat_at(std::vector<T_stat_request>& requests);
+
+  //! @brief Read all the files, at most max_size bytes each
+  //! @exception E_system if the ring cannot be used, once all the queued
+  //! operations are over and the files closed
+  void read_files(std::vector<T_read_request>& requests, uint64_t max_size);
+
+private:
+  class T_ring_lease;
+
+  uint32_t                        _queue_depth;
+  boost::mutex                    _mutex;
+  boost::ptr_vector<T_io_uring>   _rings;       // all the rings created
+  std::vector<T_io_uring*>        _free_rings;  // not used by a batch
+
+  T_io_uring& acquire_ring();
+  void release_ring(T_io_uring& ring);
+};
+
+#endif // _FILESYSTEM_URING_H_
@@ -30,99 +30,194 @@ https://github.com/antidot/AIF-Filters/
 
 #include <COMMON/BASIC/log.h>
 
+#include <fcntl.h>
+#include <string.h>
+
+namespace {
+  //! @brief Characters kept as is in a raw URI, whatever their position
+  inline bool is_plain_uri_char(unsigned char c)
+  {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+      || (c >= '0' && c <= '9') || (c != '\0' && strchr("/-._~!$&'()*+,;=:@", c));
+  }
+
+  //! @brief True if a root found at root_pos in path is a whole path prefix,
+  //! ie /data is the root of /data and /data/x, but not of /data2
+  inline bool is_root_of(const string& path, string::size_type root_pos,
+                         const string& root)
+  {
+    string::size_type end = root_pos + root.length();
+    return end == path.length() || path[end] == '/'
+      || (not root.empty() && root[root.length() - 1] == '/');
+  }
+} // namespace
+
 /*****************************************************************************/
+T_url::T_url()
+  : _root_offset(string::npos), _uri_prefix(NULL)
+{
+}
+
 T_url::~T_url()
 {
 }
 
 /*****************************************************************************/
-T_mounted_url::T_mounted_url(N_Uri::T_uri uri,
-                             const T_mounted_filesystem& mount)
-  : _mount(mount), _full_path(uri.host() + uri.path())
+void T_url::throw_not_under_root()
 {
-  LOG(INFO, 8) << "Mounted URI full path: " << _full_path;
+  throw E_user("Invalid URL: path does not contain the filesystem root");
 }
 
 /*****************************************************************************/
-T_mounted_url::T_mounted_url(const std::string& local_path,
-                             const T_mounted_filesystem& mount)
-  : _mount(mount), _local_path(local_path)
+string
+T_url::get_document_uri() const
 {
-  LOG(INFO, 8) << "Mounted URI local path: " << _local_path;
+  if (_uri_prefix == NULL)
+    {
+      return normalize_uri(get_local_path());
+    }
+  if (_root_offset == string::npos)
+    {
+      throw_not_under_root();
+    }
+  string uri;
+  uri.reserve(_uri_prefix->size() + _local_path.size() - _root_offset);
+  uri.append(*_uri_prefix).append(_local_path, _root_offset, string::npos);
+  return normalize_uri(uri);
 }
 
 /*****************************************************************************/
 string
-T_mounted_url::get_local_path() const
+T_url::normalize_uri(const string& uri)
 {
-  if (_local_path.empty())
+  // Escapes, fragments, queries, spaces or non-ASCII bytes: the URI is
+  // normalized by the parser as before
+  for (size_t i = 0; i < uri.size(); ++i)
     {
-      // Check that path contains remote root path
-      string::size_type remote_path_pos = _full_path.find(_mount.path());
-      if (remote_path_pos != string::npos)
-        {
-          _local_path = _mount.mount_point()
-            + _full_path.substr(remote_path_pos + _mount.path().length());
-          LOG(INFO, 8) << "Mounted URI local path: " << _local_path;
-        }
-      else
+      if (not is_plain_uri_char(uri[i]))
         {
-          throw E_user("Invalid Mounted URI: full path does not contain remote path");
+          return N_Uri::T_uri(uri).get_raw_uri(true, false);
         }
     }
-  return _local_path;
+  return uri;
 }
 
 /*****************************************************************************/
 N_Uri::T_uri
-T_mounted_url::get_uri() const
+T_url::get_uri() const
 {
-  if (_full_path.empty())
+  return N_Uri::T_uri(get_document_uri());
+}
+
+/*****************************************************************************/
+T_local_url::T_local_url()
+  : _name_offset(0)
+{
+}
+
+/*****************************************************************************/
+T_local_url::T_local_url(N_Uri::T_uri uri,
+                         const T_local_filesystem& fs)
+  : _name_offset(0)
+{
+  _uri_prefix = &fs.uri_prefix();
+  // Check that path is under the local root
+  string path = uri.path();
+  if (path.compare(0, fs.root_path().length(), fs.root_path()) == 0
+      && is_root_of(path, 0, fs.root_path()))
     {
-      // Check that local path contains mount point
-      string::size_type mount_point_pos =_local_path.find(_mount.mount_point());
-      if (mount_point_pos != string::npos)
-        {
-          _full_path = _mount.host() + _mount.path()
-            + _local_path.substr(mount_point_pos + _mount.mount_point().length());
-          LOG(INFO, 8) << "Mounted URI full path: " << _full_path;
-        }
-      else
-        {
-          throw E_user("Invalid Mounted URI: local path does not contain mount point");
-        }
+      _local_path = path;
+      _root_offset = 0;
     }
-  return N_Uri::T_uri("nfs://" + _full_path);
+  LOG(INFO, 8) << "Local URI path: " << path;
 }
 
 /*****************************************************************************/
-T_samba_url::T_samba_url(N_Uri::T_uri uri)
-  : _smb_url(uri.get_raw_uri(true, false))
+T_local_url::T_local_url(const std::string& local_path,
+                         const T_local_filesystem& fs)
+  : _name_offset(0)
 {
+  _uri_prefix = &fs.uri_prefix();
+  _local_path = local_path;
+  _root_offset = 0;
+  LOG(INFO, 8) << "Local URI path: " << _local_path;
 }
 
-T_samba_url::T_samba_url(const std::string& smb_url)
-  : _smb_url(smb_url)
+/*****************************************************************************/
+int T_local_url::at_fd() const
 {
+  return _parent ? _parent->fd() : AT_FDCWD;
 }
 
-T_samba_url::T_samba_url(const std::string& path,
-                         const T_samba_config& conf)
-  : _smb_url("smb://" + conf.remote_host
-           + "/" + conf.share_name
-           + path)
+/*****************************************************************************/
+const char* T_local_url::at_path() const
+{
+  return get_local_path().c_str() + (_parent ? _name_offset : 0);
+}
+
+/*****************************************************************************/
+void T_local_url::set_parent(const T_directory_fd_ptr& parent,
+                             size_t name_offset)
+{
+  _parent = parent;
+  _name_offset = name_offset;
+}
+
+/*****************************************************************************/
+void T_local_url::set_directory(const T_directory_fd_ptr& directory) const
 {
+  _directory = directory;
 }
 
+/*****************************************************************************/
+T_mounted_url::T_mounted_url(N_Uri::T_uri uri,
+                             const T_mounted_filesystem& mount)
+{
+  _uri_prefix = &mount.uri_prefix();
+  // Check that path starts with remote root path
+  string full_path = uri.host() + uri.path();
+  string::size_type remote_path_pos = uri.host().length();
+  if (full_path.compare(remote_path_pos, mount.path().length(), mount.path()) == 0
+      && is_root_of(full_path, remote_path_pos, mount.path()))
+    {
+      _local_path = mount.mount_point()
+        + full_path.substr(remote_path_pos + mount.path().length());
+      _root_offset = mount.mount_point().length();
+    }
+  LOG(INFO, 8) << "Mounted URI full path: " << full_path;
+}
 
-string T_samba_url::get_local_path() const
+/*****************************************************************************/
+T_mounted_url::T_mounted_url(const std::string& local_path,
+                             const T_mounted_filesystem& mount)
 {
-  return _smb_url;
+  _uri_prefix = &mount.uri_prefix();
+  _local_path = local_path;
+  // Check that local path starts with mount point
+  if (_local_path.compare(0, mount.mount_point().length(), mount.mount_point()) == 0
+      && is_root_of(_local_path, 0, mount.mount_point()))
+    {
+      _root_offset = mount.mount_point().length();
+    }
+  LOG(INFO, 8) << "Mounted URI local path: " << _local_path;
 }
 
-N_Uri::T_uri T_samba_url::get_uri() const
+/*****************************************************************************/
+T_samba_url::T_samba_url(N_Uri::T_uri uri)
 {
-  return N_Uri::T_uri(_smb_url);
+  _local_path = uri.get_raw_uri(true, false);
+  _root_offset = 0;
 }
 
+T_samba_url::T_samba_url(const std::string& smb_url)
+{
+  _local_path = smb_url;
+  _root_offset = 0;
+}
 
+T_samba_url::T_samba_url(const std::string& path,
+                         const T_samba_config& conf)
+{
+  _local_path = "smb://" + conf.remote_host + "/" + conf.share_name + path;
+  _root_offset = 0;
+}
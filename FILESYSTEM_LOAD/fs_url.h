@@ -30,10 +30,17 @@ https://github.com/antidot/AIF-Filters/
 #include <COMMON/META/antidot.h>
 #include <boost/shared_ptr.hpp>
 
+class T_directory_fd;
+class T_local_filesystem;
 class T_mounted_filesystem;
 class T_samba_config;
 
 /*****************************************************************************/
+//! @brief Location of a file or directory, translated once at creation
+//! The local path is stored with the offset of the part below the
+//! filesystem root: the document URI is this part appended to the URI
+//! prefix of the root, only parsed if it has characters the URI parser
+//! could change (see fs_check).
 class T_url
 {
 public:
@@ -42,57 +49,98 @@ public:
   //! @brief Retrieves the local path used by proxy calls
   //! @return file or dir path (may contain a trailing slash or not)
   //! @exception E_user if uri does not match the nfs mount path
-  virtual std::string get_local_path() const = 0;
+  const std::string& get_local_path() const
+  {
+    if (_local_path.empty())
+      {
+        throw_not_under_root();
+      }
+    return _local_path;
+  }
+
+  //! @brief Retrieves the raw uri, used as PaF document URI
+  //! @exception E_user if local path does not match the nfs mount point
+  std::string get_document_uri() const;
 
   //! @brief Retrieves the uri
-  virtual N_Uri::T_uri get_uri() const = 0;
+  N_Uri::T_uri get_uri() const;
+
+protected:
+  T_url();
+
+  std::string             _local_path;
+  std::string::size_type  _root_offset; // npos if not under the root
+  const std::string*      _uri_prefix; // NULL if the local path is the URI
+
+private:
+  static void throw_not_under_root();
 
+  //! @brief Same URI as N_Uri::T_uri(uri).get_raw_uri(true, false)
+  static std::string normalize_uri(const std::string& uri);
 };
 
 typedef boost::shared_ptr<T_url> T_url_ptr;
 
 /*****************************************************************************/
-class T_mounted_url : public T_url
+//! @brief Local path is the absolute path of the file,
+//! URI is the file uri ie file://host/absolute_path
+//! Once its parent directory is listed, the file is resolved from it.
+class T_local_url : public T_url
 {
 public:
-  T_mounted_url(N_Uri::T_uri uri,
-                const T_mounted_filesystem& mount);
+  typedef boost::shared_ptr<T_directory_fd> T_directory_fd_ptr;
 
-  T_mounted_url(const std::string& local_path,
-                const T_mounted_filesystem& mount);
+  T_local_url(N_Uri::T_uri uri,
+              const T_local_filesystem& fs);
 
-  //! @brief Retrieves the local path ie /mount_path/remote_relative_path
-  //! @return file or dir path (may contain a trailing slash or not)
-  //! @exception E_user if uri does not match the nfs mount path
-  std::string get_local_path() const;
+  T_local_url(const std::string& local_path,
+              const T_local_filesystem& fs);
 
-  //! @brief Retrieves the NFS uri ie nfs://host/remote_absolute_path
-  N_Uri::T_uri get_uri() const;
+  //! @brief Directory to resolve at_path() from (*at syscalls)
+  //! @return the open parent directory, or AT_FDCWD
+  int at_fd() const;
+
+  //! @brief Path relative to at_fd(): entry name, or absolute local path
+  const char* at_path() const;
+
+  //! @brief Resolve the entry from its open parent directory
+  //! @param name_offset position of the entry name in the local path
+  void set_parent(const T_directory_fd_ptr& parent, size_t name_offset);
+
+  //! @brief Keep the listed directory open for the URLs of its entries
+  void set_directory(const T_directory_fd_ptr& directory) const;
+  const T_directory_fd_ptr& get_directory() const { return _directory; }
+
+protected:
+  T_local_url();
 
 private:
-  const T_mounted_filesystem&    _mount;
-  mutable std::string   _full_path; // remote_host/mount_root/remote_path
-  mutable std::string   _local_path;
+  T_directory_fd_ptr          _parent;
+  size_t                      _name_offset;
+  mutable T_directory_fd_ptr  _directory;
 };
 
 /*****************************************************************************/
+//! @brief Local path is /mount_path/remote_relative_path,
+//! URI is the NFS uri ie nfs://host/remote_absolute_path
+class T_mounted_url : public T_local_url
+{
+public:
+  T_mounted_url(N_Uri::T_uri uri,
+                const T_mounted_filesystem& mount);
+
+  T_mounted_url(const std::string& local_path,
+                const T_mounted_filesystem& mount);
+};
+
+/*****************************************************************************/
+//! @brief Local path and URI are the samba url ie smb://host/share/path
 class T_samba_url : public T_url
 {
 public:
   T_samba_url(N_Uri::T_uri uri);
   T_samba_url(const std::string& smb_url);
   T_samba_url(const std::string& path, const T_samba_config& conf);
-
-  //! @brief Retrieves the samba url ie smb:://host/share/path
-  //! @return file or dir url
-  std::string get_local_path() const;
-
-  //! @brief Retrieves the samba uri
-  N_Uri::T_uri get_uri() const;
-
-private:
-  mutable std::string _smb_url; // eg //host/share/path
-  
 };
 
 #endif // _FILESYSTEM_URI_H